@@ -0,0 +1,70 @@
+#ifndef _RACE_IOCTL_H
+#define _RACE_IOCTL_H
+
+/**
+ * ioctl interface of /dev/race, shared by the FreeBSD driver, the Linux
+ * port and user space.
+ *
+ * RACE_IOC_ATTACH creates a unit and returns its number, the lowest one
+ * free. RACE_IOC_DETACH and RACE_IOC_QUERY take a unit number and fail
+ * with ENOENT when it is not attached.
+ */
+
+#if defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/ioccom.h>
+#elif defined(__KERNEL__)
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <linux/ioctl.h>
+#endif
+
+#define RACE_NAME           "race"
+
+#define RACE_IOC_ATTACH     _IOR('R', 0, int)
+#define RACE_IOC_DETACH     _IOW('R', 1, int)
+#define RACE_IOC_QUERY      _IOW('R', 2, int)
+#define RACE_IOC_LIST       _IO('R', 3)
+
+/**
+ * Batched commands, count units in one call and one lock acquisition.
+ * RACE_IOC_ATTACH_BATCH creates count units and fills units in, the
+ * others take the units to detach or query. status receives 0 or an
+ * errno value per unit, the ioctl itself only fails when the arrays
+ * cannot be accessed or count is above RACE_BATCH_MAX. An attach batch
+ * that fails to return its units detaches them again.
+ */
+#define RACE_BATCH_MAX      65536
+
+struct race_batch {
+    uint64_t units;     /* int *, count entries */
+    uint64_t status;    /* int *, count entries, out */
+    uint32_t count;
+    uint32_t pad;
+};
+
+#define RACE_IOC_ATTACH_BATCH   _IOW('R', 4, struct race_batch)
+#define RACE_IOC_DETACH_BATCH   _IOW('R', 5, struct race_batch)
+#define RACE_IOC_QUERY_BATCH    _IOW('R', 6, struct race_batch)
+
+/**
+ * RACE_IOC_LIST_UNITS copies up to max attached units, in ascending
+ * order from cursor, to units and sets count. cursor is 0 for the first
+ * call and is advanced past the last unit returned, -1 once the list is
+ * done. Paging through the list returns every unit attached for the
+ * whole walk exactly once; units attached or detached meanwhile may or
+ * may not show up. max is 1 to RACE_BATCH_MAX.
+ */
+struct race_list {
+    uint64_t units;     /* int *, max entries, out */
+    int32_t cursor;     /* in and out */
+    uint32_t max;
+    uint32_t count;     /* out */
+    uint32_t pad;
+};
+
+#define RACE_IOC_LIST_UNITS     _IOWR('R', 7, struct race_list)
+
+#endif /* _RACE_IOCTL_H */
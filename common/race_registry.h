@@ -0,0 +1,244 @@
+#ifndef _RACE_REGISTRY_H
+#define _RACE_REGISTRY_H
+
+/**
+ * Unit registry of the race driver, shared by the FreeBSD driver and
+ * the Linux port.
+ *
+ * Units index a two level table: the top 12 bits of a unit pick a leaf
+ * of the root, the low 12 bits a slot of the leaf, so a lookup is two
+ * loads. Each leaf keeps a bitmap of its used slots and the root one of
+ * its full leaves, a new unit is the lowest free one and found by
+ * scanning at most two 64 word bitmaps, whatever the number of units.
+ * Leaves are allocated on first use and kept until the registry is
+ * destroyed.
+ *
+ * The registry does no locking, callers serialize changes. Lookups
+ * and race_reg_next() may run concurrently with them: leaves and slots
+ * are published with release stores after they are set up and leaves
+ * are never freed while the registry is in use, so a reader under
+ * epoch(9) or RCU only needs the objects it finds to outlive its read
+ * section. Functions return 0 or a positive errno.
+ */
+
+#ifdef __FreeBSD__
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/errno.h>
+#include <sys/malloc.h>
+#include <machine/atomic.h>
+
+MALLOC_DECLARE(M_RACE);
+
+/* leaves are allocated under the caller's mutex */
+#define RACE_REG_ALLOC(size)    malloc((size), M_RACE, M_NOWAIT | M_ZERO)
+#define RACE_REG_FREE(p)        free((p), M_RACE)
+#define RACE_REG_LOAD(p)        \
+    ((__typeof(*(p)))atomic_load_acq_ptr((volatile uintptr_t *)(p)))
+#define RACE_REG_STORE(p, v)    \
+    atomic_store_rel_ptr((volatile uintptr_t *)(p), (uintptr_t)(v))
+#else
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <asm/barrier.h>
+
+#define RACE_REG_ALLOC(size)    kvzalloc((size), GFP_KERNEL)
+#define RACE_REG_FREE(p)        kvfree(p)
+#define RACE_REG_LOAD(p)        smp_load_acquire(p)
+#define RACE_REG_STORE(p, v)    smp_store_release(p, v)
+#endif
+
+/* A word a lockless reader may see change, old or new value */
+#define RACE_REG_READ(x)        (*(volatile __typeof(x) *)&(x))
+
+#define RACE_REG_SHIFT      12
+#define RACE_REG_FANOUT     (1 << RACE_REG_SHIFT)
+#define RACE_REG_MASK       (RACE_REG_FANOUT - 1)
+#define RACE_REG_WORDS      (RACE_REG_FANOUT / 64)
+#define RACE_REG_MAX_UNITS  (RACE_REG_FANOUT * RACE_REG_FANOUT)
+
+struct race_reg_leaf {
+    void *slot[RACE_REG_FANOUT];
+    uint64_t used[RACE_REG_WORDS];
+    unsigned int count;
+};
+
+struct race_reg {
+    struct race_reg_leaf *leaf[RACE_REG_FANOUT];
+    uint64_t full[RACE_REG_WORDS];      /* leaves without a free slot */
+    unsigned int count;
+};
+
+/* First clear bit of a bitmap of RACE_REG_WORDS words, -1 if none */
+static inline int
+race_reg_first_zero(const uint64_t *map)
+{
+    int w;
+
+    for (w = 0; w < RACE_REG_WORDS; w++)
+        if (~map[w] != 0)
+            return (w * 64 + __builtin_ctzll(~map[w]));
+    return (-1);
+}
+
+/* First set bit at or after bit, -1 if none */
+static inline int
+race_reg_next_set(const uint64_t *map, int bit)
+{
+    int w = bit / 64;
+    uint64_t word;
+
+    if (bit >= RACE_REG_FANOUT)
+        return (-1);
+    word = RACE_REG_READ(map[w]) & (~0ULL << (bit % 64));
+    for (;;) {
+        if (word != 0)
+            return (w * 64 + __builtin_ctzll(word));
+        if (++w == RACE_REG_WORDS)
+            return (-1);
+        word = RACE_REG_READ(map[w]);
+    }
+}
+
+static inline void *
+race_reg_find(struct race_reg *reg, int unit)
+{
+    struct race_reg_leaf *leaf;
+
+    if (unit < 0 || unit >= RACE_REG_MAX_UNITS)
+        return (NULL);
+    leaf = RACE_REG_LOAD(&reg->leaf[unit >> RACE_REG_SHIFT]);
+    return (leaf != NULL ? RACE_REG_LOAD(&leaf->slot[unit & RACE_REG_MASK]) :
+            NULL);
+}
+
+/**
+ * Store p under the lowest free unit and return it in *unitp. ENOSPC
+ * when all RACE_REG_MAX_UNITS units are taken, ENOMEM when a new leaf
+ * cannot be allocated.
+ */
+static inline int
+race_reg_insert(struct race_reg *reg, void *p, int *unitp)
+{
+    struct race_reg_leaf *leaf;
+    int l, s;
+
+    l = race_reg_first_zero(reg->full);
+    if (l < 0)
+        return (ENOSPC);
+    leaf = reg->leaf[l];
+    if (leaf == NULL) {
+        leaf = RACE_REG_ALLOC(sizeof(*leaf));
+        if (leaf == NULL)
+            return (ENOMEM);
+        RACE_REG_STORE(&reg->leaf[l], leaf);
+    }
+
+    /* the unit is known to p before readers can find p */
+    s = race_reg_first_zero(leaf->used);
+    *unitp = (l << RACE_REG_SHIFT) | s;
+    RACE_REG_STORE(&leaf->slot[s], p);
+    leaf->used[s / 64] |= 1ULL << (s % 64);
+    if (++leaf->count == RACE_REG_FANOUT)
+        reg->full[l / 64] |= 1ULL << (l % 64);
+    reg->count++;
+    return (0);
+}
+
+/**
+ * Take unit out of the registry, returns what it held or NULL. Readers
+ * may still hold it until their read section ends.
+ */
+static inline void *
+race_reg_remove(struct race_reg *reg, int unit)
+{
+    struct race_reg_leaf *leaf;
+    int l = unit >> RACE_REG_SHIFT, s = unit & RACE_REG_MASK;
+    void *p;
+
+    p = race_reg_find(reg, unit);
+    if (p == NULL)
+        return (NULL);
+    leaf = reg->leaf[l];
+    RACE_REG_STORE(&leaf->slot[s], NULL);
+    leaf->used[s / 64] &= ~(1ULL << (s % 64));
+    leaf->count--;
+    reg->full[l / 64] &= ~(1ULL << (l % 64));
+    reg->count--;
+    return (p);
+}
+
+/**
+ * The lowest attached unit at or after unit, -1 if there is none. A
+ * lockless caller sees every unit attached for the whole call.
+ */
+static inline int
+race_reg_next(struct race_reg *reg, int unit)
+{
+    struct race_reg_leaf *leaf;
+    int l, s;
+
+    if (unit < 0)
+        unit = 0;
+    for (l = unit >> RACE_REG_SHIFT; l < RACE_REG_FANOUT; l++) {
+        leaf = RACE_REG_LOAD(&reg->leaf[l]);
+        if (leaf != NULL && RACE_REG_READ(leaf->count) != 0) {
+            s = race_reg_next_set(leaf->used, l == unit >> RACE_REG_SHIFT ?
+                                  unit & RACE_REG_MASK : 0);
+            if (s >= 0)
+                return ((l << RACE_REG_SHIFT) | s);
+        }
+    }
+    return (-1);
+}
+
+/**
+ * Copy up to max attached units from *cursorp on to units and return
+ * how many, see RACE_IOC_LIST_UNITS. *cursorp is left past the last one
+ * copied or at -1 when there are no more, max must not be 0 or the
+ * cursor never moves. Reads only the bitmaps, so it needs no lock and no
+ * read section.
+ */
+static inline unsigned int
+race_reg_snapshot(struct race_reg *reg, int *cursorp, int *units,
+                  unsigned int max)
+{
+    unsigned int n = 0;
+    int unit;
+
+    if (*cursorp < 0)
+        return (0);
+    for (unit = *cursorp; n < max; unit++) {
+        unit = race_reg_next(reg, unit);
+        if (unit < 0)
+            break;
+        units[n++] = unit;
+    }
+    *cursorp = unit;
+    return (n);
+}
+
+/* Remove every unit, passing what it held to dtor, and free the leaves */
+static inline void
+race_reg_destroy(struct race_reg *reg, void (*dtor)(void *))
+{
+    struct race_reg_leaf *leaf;
+    int l, s;
+
+    for (l = 0; l < RACE_REG_FANOUT; l++) {
+        leaf = reg->leaf[l];
+        if (leaf == NULL)
+            continue;
+        for (s = race_reg_next_set(leaf->used, 0); s >= 0;
+             s = race_reg_next_set(leaf->used, s + 1))
+            dtor(leaf->slot[s]);
+        RACE_REG_FREE(leaf);
+        reg->leaf[l] = NULL;
+    }
+    memset(reg->full, 0, sizeof(reg->full));
+    reg->count = 0;
+}
+
+#endif /* _RACE_REGISTRY_H */
@@ -44,19 +44,31 @@ echo_close(struct cdev *dev, int fflag, int devtype, struct thread *td)
     return (0);
 }
 
+/*
+ * Write the whole uio, every iovec, at the file offset. A write ends
+ * the message, so a write at offset 0 replaces it.
+ */
 static int
 echo_write(struct cdev *dev, struct uio *uio, int ioflag)
 {
     int error = 0;
-    error = copyin(uio->uio_iov->iov_base, echo_message->buffer,
-                   MIN(uio->uio_iov->iov_len, BUFFER_SIZE - 1));
-    if (error != 0) {
-        uprintf("Write failed.\n");
+    int amount;
+
+    if (uio->uio_resid == 0)
         return (error);
-    }
-    *(echo_message->buffer +
-            MIN(uio->uio_iov->iov_len, BUFFER_SIZE - 1)) = 0;
-    echo_message->length = MIN(uio->uio_iov->iov_len, BUFFER_SIZE - 1);
+    if (uio->uio_offset >= BUFFER_SIZE - 1)
+        return (ENOSPC);
+
+    amount = MIN(uio->uio_resid, BUFFER_SIZE - 1 - uio->uio_offset);
+    if (uio->uio_offset > echo_message->length)
+        memset(echo_message->buffer + echo_message->length, 0,
+            uio->uio_offset - echo_message->length);
+
+    error = uiomove(echo_message->buffer + uio->uio_offset, amount, uio);
+    echo_message->length = uio->uio_offset;
+    echo_message->buffer[echo_message->length] = 0;
+    if (error != 0)
+        uprintf("Write failed.\n");
 
     return (error);
 }
@@ -82,7 +94,7 @@ echo_modevent(module_t mod __unused, int event, void *arg __unused)
     int error = 0;
     switch (event) {
     case MOD_LOAD:
-        echo_message = malloc(sizeof(echo_t), M_TEMP, M_WAITOK);
+        echo_message = malloc(sizeof(echo_t), M_TEMP, M_WAITOK | M_ZERO);
         echo_dev = make_dev(&echo_cdevsw, 0, UID_ROOT, GID_WHEEL,
                             0600, "echo");
         uprintf("Echo driver loaded.\n");
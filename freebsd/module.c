@@ -6,6 +6,12 @@
 #include <sys/uio.h>
 #include <sys/malloc.h>
 #include <sys/ioccom.h>
+#include <sys/fcntl.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/selinfo.h>
+#include <sys/poll.h>
+#include <sys/event.h>
 
 MALLOC_DEFINE(M_ECHO, "echo_buffer", "buffer for echo driver");
 
@@ -18,6 +24,11 @@ static d_close_t echo_close;
 static d_read_t echo_read;
 static d_write_t echo_write;
 static d_ioctl_t echo_ioctl;
+static d_poll_t echo_poll;
+static d_kqfilter_t echo_kqfilter;
+
+static void filt_echodetach(struct knote *kn);
+static int filt_echoread(struct knote *kn, long hint);
 
 static struct cdevsw echo_cdevsw = {
     .d_version = D_VERSION,
@@ -26,21 +37,78 @@ static struct cdevsw echo_cdevsw = {
     .d_read    = echo_read,
     .d_write   = echo_write,
     .d_ioctl   = echo_ioctl,
+    .d_poll    = echo_poll,
+    .d_kqfilter = echo_kqfilter,
     .d_name    = "echo"
 };
 
+static struct filterops echo_read_filterops = {
+    .f_isfd   = 1,
+    .f_detach = filt_echodetach,
+    .f_event  = filt_echoread,
+};
+
 typedef struct echo {
     int buffer_size;
     char *buffer;
     int length;
 } echo_t;
 
+/* Per open file state, the cdevpriv of the file */
+struct echo_file {
+    int append;     /* devfs does not pass O_APPEND down as IO_APPEND */
+    u_int seen;     /* echo_generation when this file read last */
+};
+
 static echo_t *echo_message;
 static struct cdev *echo_dev;
 
+/*
+ * Readiness. Every change of the message bumps echo_generation, a file
+ * is readable while it has not read the current one. echo_armed is set
+ * by a poller or knote that found nothing to read, only a change that
+ * finds it set wakes anybody, so a burst of writes wakes a waiter once.
+ */
+static struct mtx echo_mtx;
+static struct selinfo echo_sel;
+static u_int echo_generation;
+static int echo_armed;
+
+static void
+echo_file_dtor(void *data)
+{
+    free(data, M_ECHO);
+}
+
+static void
+echo_notify(void)
+{
+    int armed;
+
+    mtx_lock(&echo_mtx);
+    echo_generation++;
+    armed = echo_armed;
+    echo_armed = 0;
+    if (armed)
+        KNOTE_LOCKED(&echo_sel.si_note, 0);
+    mtx_unlock(&echo_mtx);
+    if (armed)
+        selwakeup(&echo_sel);
+}
+
 static int
 echo_open(struct cdev *dev, int oflags, int devtype, struct thread *td)
 {
+    struct echo_file *ef;
+    int error;
+
+    ef = malloc(sizeof(*ef), M_ECHO, M_WAITOK | M_ZERO);
+    ef->append = (oflags & O_APPEND) != 0;
+    error = devfs_set_cdevpriv(ef, echo_file_dtor);
+    if (error != 0) {
+        free(ef, M_ECHO);
+        return (error);
+    }
     uprintf("Opening echo device.\n");
     return (0);
 }
@@ -52,26 +120,41 @@ echo_close(struct cdev *dev, int fflag, int devtype, struct thread *td)
     return (0);
 }
 
+/*
+ * Write the whole uio, every iovec, at the file offset or with O_APPEND
+ * at the end of the message. A write ends the message, so a write at
+ * offset 0 replaces it.
+ */
 static int
 echo_write(struct cdev *dev, struct uio *uio, int ioflag)
 {
+    struct echo_file *ef;
     int error = 0;
     int amount;
 
-    amount = MIN(uio->uio_resid,
-        (echo_message->buffer_size - 1 - uio->uio_offset > 0) ?
-        echo_message->buffer_size - 1 - uio->uio_offset : 0);
-    if (amount == 0)
+    if (uio->uio_resid == 0)
         return (error);
-
-    error = uiomove(echo_message->buffer, amount, uio);
-    if (error != 0) {
-        uprintf("Write failed.\n");
+    error = devfs_get_cdevpriv((void **)&ef);
+    if (error != 0)
         return (error);
-    }
+    if ((ioflag & IO_APPEND) || ef->append)
+        uio->uio_offset = echo_message->length;
+    if (uio->uio_offset >= echo_message->buffer_size - 1)
+        return (ENOSPC);
+
+    amount = MIN(uio->uio_resid,
+        echo_message->buffer_size - 1 - uio->uio_offset);
+    if (uio->uio_offset > echo_message->length)
+        memset(echo_message->buffer + echo_message->length, '\0',
+            uio->uio_offset - echo_message->length);
 
-    echo_message->buffer[amount] = '\0';
-    echo_message->length = amount;
+    error = uiomove(echo_message->buffer + uio->uio_offset, amount, uio);
+    /* uio_offset has advanced past whatever was copied */
+    echo_message->length = uio->uio_offset;
+    echo_message->buffer[echo_message->length] = '\0';
+    if (error != 0)
+        uprintf("Write failed.\n");
+    echo_notify();
 
     return (error);
 }
@@ -79,8 +162,17 @@ echo_write(struct cdev *dev, struct uio *uio, int ioflag)
 static int
 echo_read(struct cdev *dev, struct uio *uio, int ioflag)
 {
+    struct echo_file *ef;
     int error = 0;
     int amount;
+
+    error = devfs_get_cdevpriv((void **)&ef);
+    if (error != 0)
+        return (error);
+    mtx_lock(&echo_mtx);
+    ef->seen = echo_generation;
+    mtx_unlock(&echo_mtx);
+
     amount = MIN(uio->uio_resid,
                  (echo_message->length - uio->uio_offset > 0) ?
                      echo_message->length - uio->uio_offset : 0);
@@ -121,11 +213,13 @@ echo_ioctl(struct cdev *dev, u_long cmd, caddr_t data, int fflag, struct thread
         memset(echo_message->buffer, '\0',
         echo_message->buffer_size);
         echo_message->length = 0;
+        echo_notify();
         uprintf("Buffer cleared.\n");
         break;
     case ECHO_SET_BUFFER_SIZE:
         error = echo_set_buffer_size(*(int *)data);
         if (error == 0) {
+            echo_notify();
             uprintf("Buffer resized.\n");
         }
         break;
@@ -137,21 +231,96 @@ echo_ioctl(struct cdev *dev, u_long cmd, caddr_t data, int fflag, struct thread
     return (error);
 }
 
+static int
+echo_poll(struct cdev *dev, int events, struct thread *td)
+{
+    struct echo_file *ef;
+    int revents = 0;
+
+    if (devfs_get_cdevpriv((void **)&ef) != 0)
+        return (events & (POLLHUP | POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM));
+
+    mtx_lock(&echo_mtx);
+    if (events & (POLLIN | POLLRDNORM)) {
+        if (ef->seen != echo_generation) {
+            revents |= events & (POLLIN | POLLRDNORM);
+        } else {
+            echo_armed = 1;
+            selrecord(td, &echo_sel);
+        }
+    }
+    mtx_unlock(&echo_mtx);
+    /* a write never waits */
+    revents |= events & (POLLOUT | POLLWRNORM);
+
+    return (revents);
+}
+
+static int
+echo_kqfilter(struct cdev *dev, struct knote *kn)
+{
+    struct echo_file *ef;
+    int error;
+
+    error = devfs_get_cdevpriv((void **)&ef);
+    if (error != 0)
+        return (error);
+
+    switch (kn->kn_filter) {
+    case EVFILT_READ:
+        kn->kn_fop = &echo_read_filterops;
+        kn->kn_hook = ef;
+        knlist_add(&echo_sel.si_note, kn, 0);
+        break;
+    default:
+        error = EINVAL;
+        break;
+    }
+
+    return (error);
+}
+
+static void
+filt_echodetach(struct knote *kn)
+{
+    knlist_remove(&echo_sel.si_note, kn, 0);
+}
+
+static int
+filt_echoread(struct knote *kn, long hint)
+{
+    struct echo_file *ef = kn->kn_hook;
+
+    mtx_assert(&echo_mtx, MA_OWNED);
+    kn->kn_data = echo_message->length;
+    if (ef->seen != echo_generation)
+        return (1);
+    echo_armed = 1;
+    return (0);
+}
+
 static int
 echo_modevent(module_t mod __unused, int event, void *arg __unused)
 {
     int error = 0;
     switch (event) {
     case MOD_LOAD:
-        echo_message = malloc(sizeof(echo_t), M_ECHO, M_WAITOK);
+        echo_message = malloc(sizeof(echo_t), M_ECHO, M_WAITOK | M_ZERO);
         echo_message->buffer_size = 256;
-        echo_message->buffer = malloc(echo_message->buffer_size, M_ECHO, M_WAITOK);
+        echo_message->buffer = malloc(echo_message->buffer_size, M_ECHO,
+            M_WAITOK | M_ZERO);
+        mtx_init(&echo_mtx, "echo", NULL, MTX_DEF);
+        knlist_init_mtx(&echo_sel.si_note, &echo_mtx);
         echo_dev = make_dev(&echo_cdevsw, 0, UID_ROOT, GID_WHEEL,
                             0600, "echo");
         uprintf("Echo driver loaded.\n");
         break;
     case MOD_UNLOAD:
         destroy_dev(echo_dev);
+        seldrain(&echo_sel);
+        knlist_clear(&echo_sel.si_note, 0);
+        knlist_destroy(&echo_sel.si_note);
+        mtx_destroy(&echo_mtx);
         free(echo_message->buffer, M_ECHO);
         free(echo_message, M_ECHO);
         uprintf("Echo driver unloaded.\n");
@@ -6,31 +6,58 @@
 #include <sys/uio.h>
 #include <sys/malloc.h>
 #include <sys/ioccom.h>
-#include <sys/queue.h>
 #include <sys/mutex.h>
-//#include "race_ioctl.h"
-
-#define RACE_NAME "race"
-#define RACE_IOC_ATTACH _IOR('R', 0, int)
-#define RACE_IOC_DETACH _IOW('R', 1, int)
-#define RACE_IOC_QUERY  _IOW('R', 2, int)
-#define RACE_IOC_LIST   _IO('R', 3)
+#include <sys/epoch.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
+#include <sys/counter.h>
+#include <vm/uma.h>
+#include "race_ioctl.h"
+#include "race_registry.h"
 
 MALLOC_DEFINE(M_RACE, "race", "race object");
 
+/*
+ * race_mtx serializes attach and detach. Query takes no lock, it runs
+ * in a race_epoch section and a detached softc is freed only once every
+ * section that may have found it has ended. The list commands and
+ * debug.race_units only read the registry bitmaps and need neither.
+ *
+ * Softcs come from race_zone, a cache-line aligned UMA zone, so attach
+ * and detach churn is served from its per-CPU buckets instead of
+ * malloc(9). Zone init runs once for every item of a new keg slab, so
+ * it counts the objects carved from new slabs; debug.race_cache shows
+ * them with the allocations and frees. Bucket hits and misses are in
+ * UMA's own statistics, vm.uma.race_softc.
+ */
 static struct mtx race_mtx;
+static epoch_t race_epoch;
 
 struct race_softc {
-    LIST_ENTRY(race_softc) list;
     int unit;
+    struct epoch_context ctx;
 };
 
-static LIST_HEAD(, race_softc) race_list =
-    LIST_HEAD_INITIALIZER(&race_list);
+/* Attached units by number, see race_registry.h */
+static struct race_reg race_units;
+
+static uma_zone_t race_zone;
+static counter_u64_t race_allocs;
+static counter_u64_t race_frees;
+static counter_u64_t race_slab_items;
 
-static struct race_softc *race_new(void);
+static int                race_zinit(void *mem, int size, int flags);
+static struct race_softc *race_alloc(void);
+static int                race_new(struct race_softc **scp);
 static struct race_softc *race_find(int unit);
 static void               race_destroy(struct race_softc *sc);
+static void               race_free(void *sc);
+static void               race_free_epoch(epoch_context_t ctx);
+static int                race_batch(u_long cmd, struct race_batch *rb);
+static int                race_list(void);
+static int                race_list_units(struct race_list *rl);
+static int                race_sysctl_units(SYSCTL_HANDLER_ARGS);
+static int                race_sysctl_cache(SYSCTL_HANDLER_ARGS);
 static d_ioctl_t          race_ioctl_mtx;
 static d_ioctl_t          race_ioctl;
 
@@ -42,10 +69,37 @@ static struct cdevsw race_cdevsw = {
 
 static struct cdev *race_dev;
 
+/* Units listed per page by RACE_IOC_LIST and the sysctl */
+#define RACE_LIST_PAGE  1024
+
+SYSCTL_PROC(_debug, OID_AUTO, race_units,
+            CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+            race_sysctl_units, "A", "Attached race units");
+SYSCTL_PROC(_debug, OID_AUTO, race_cache,
+            CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+            race_sysctl_cache, "A", "race_softc zone allocations");
+
 static int
 race_ioctl_mtx(struct cdev *dev, u_long cmd, caddr_t data, int fflag, struct thread *td)
 {
+    struct epoch_tracker et;
     int error;
+    switch (cmd) {
+    case RACE_IOC_ATTACH_BATCH:
+    case RACE_IOC_DETACH_BATCH:
+    case RACE_IOC_QUERY_BATCH:
+        /* copies the arrays in and out, locks only around the batch */
+        return (race_batch(cmd, (struct race_batch *)data));
+    case RACE_IOC_LIST_UNITS:
+        return (race_list_units((struct race_list *)data));
+    case RACE_IOC_LIST:
+        return (race_list());
+    case RACE_IOC_QUERY:
+        epoch_enter_preempt(race_epoch, &et);
+        error = race_ioctl(dev, cmd, data, fflag, td);
+        epoch_exit_preempt(race_epoch, &et);
+        return (error);
+    }
     mtx_lock(&race_mtx);
     error = race_ioctl(dev, cmd, data, fflag, td);
     mtx_unlock(&race_mtx);
@@ -59,8 +113,9 @@ race_ioctl(struct cdev *dev, u_long cmd, caddr_t data, int fflag, struct thread
     int error = 0;
     switch (cmd) {
     case RACE_IOC_ATTACH:
-        sc = race_new();
-        *(int *)data = sc->unit;
+        error = race_new(&sc);
+        if (error == 0)
+            *(int *)data = sc->unit;
         break;
     case RACE_IOC_DETACH:
         sc = race_find(*(int *)data);
@@ -73,11 +128,6 @@ race_ioctl(struct cdev *dev, u_long cmd, caddr_t data, int fflag, struct thread
         if (sc == NULL)
             return (ENOENT);
         break;
-    case RACE_IOC_LIST:
-        uprintf(" UNIT\n");
-        LIST_FOREACH(sc, &race_list, list)
-            uprintf(" %d\n", sc->unit);
-        break;
     default:
         error = ENOTTY;
         break;
@@ -86,48 +136,241 @@ race_ioctl(struct cdev *dev, u_long cmd, caddr_t data, int fflag, struct thread
     return (error);
 }
 
+/*
+ * Run a batch, see race_ioctl.h. The softcs of an attach batch are
+ * allocated before race_mtx is taken, the status and unit arrays are
+ * copied out after it is dropped. When that copyout fails the new
+ * units are detached again, those still holding the softc this batch
+ * attached.
+ */
+static int
+race_batch(u_long cmd, struct race_batch *rb)
+{
+    struct race_softc **scs = NULL, *sc;
+    struct epoch_tracker et;
+    int *units, *status, error = 0;
+    size_t len = (size_t)rb->count * sizeof(int);
+    uint32_t i;
+    if (rb->count > RACE_BATCH_MAX)
+        return (EINVAL);
+    units = malloc(2 * len, M_RACE, M_WAITOK);
+    status = units + rb->count;
+    if (cmd == RACE_IOC_ATTACH_BATCH) {
+        scs = malloc(rb->count * sizeof(*scs), M_RACE, M_WAITOK);
+        for (i = 0; i < rb->count; i++)
+            scs[i] = race_alloc();
+    } else {
+        error = copyin((void *)(uintptr_t)rb->units, units, len);
+        if (error != 0)
+            goto out;
+    }
+
+    switch (cmd) {
+    case RACE_IOC_ATTACH_BATCH:
+        mtx_lock(&race_mtx);
+        for (i = 0; i < rb->count; i++) {
+            status[i] = race_reg_insert(&race_units, scs[i], &scs[i]->unit);
+            if (status[i] == 0) {
+                units[i] = scs[i]->unit;
+            } else {
+                race_free(scs[i]);
+                units[i] = -1;
+            }
+        }
+        mtx_unlock(&race_mtx);
+        break;
+    case RACE_IOC_DETACH_BATCH:
+        mtx_lock(&race_mtx);
+        for (i = 0; i < rb->count; i++) {
+            sc = race_find(units[i]);
+            if (sc != NULL)
+                race_destroy(sc);
+            status[i] = sc != NULL ? 0 : ENOENT;
+        }
+        mtx_unlock(&race_mtx);
+        break;
+    case RACE_IOC_QUERY_BATCH:
+        epoch_enter_preempt(race_epoch, &et);
+        for (i = 0; i < rb->count; i++)
+            status[i] = race_find(units[i]) != NULL ? 0 : ENOENT;
+        epoch_exit_preempt(race_epoch, &et);
+        break;
+    }
+
+    error = copyout(status, (void *)(uintptr_t)rb->status, len);
+    if (error == 0 && cmd == RACE_IOC_ATTACH_BATCH)
+        error = copyout(units, (void *)(uintptr_t)rb->units, len);
+    if (error != 0 && cmd == RACE_IOC_ATTACH_BATCH) {
+        mtx_lock(&race_mtx);
+        for (i = 0; i < rb->count; i++)
+            if (status[i] == 0 && race_find(units[i]) == scs[i])
+                race_destroy(scs[i]);
+        mtx_unlock(&race_mtx);
+    }
+out:
+    free(scs, M_RACE);
+    free(units, M_RACE);
+    return (error);
+}
+
+/*
+ * RACE_IOC_LIST, the units on the caller's terminal. uprintf(9) may
+ * sleep, so the units are taken a page at a time with
+ * race_reg_snapshot(), which needs no lock, and printed from the copy.
+ */
+static int
+race_list(void)
+{
+    int *units, cursor = 0;
+    unsigned int i, n;
+    units = malloc(RACE_LIST_PAGE * sizeof(int), M_RACE, M_WAITOK);
+    uprintf(" UNIT\n");
+    do {
+        n = race_reg_snapshot(&race_units, &cursor, units, RACE_LIST_PAGE);
+        for (i = 0; i < n; i++)
+            uprintf(" %d\n", units[i]);
+    } while (cursor >= 0);
+    free(units, M_RACE);
+    return (0);
+}
+
+/*
+ * One page of RACE_IOC_LIST_UNITS. The snapshot reads only the registry
+ * bitmaps and takes neither race_mtx nor the epoch, the copyout runs
+ * on the private copy.
+ */
+static int
+race_list_units(struct race_list *rl)
+{
+    int *units, error;
+    if (rl->max == 0 || rl->max > RACE_BATCH_MAX)
+        return (EINVAL);
+    units = malloc((size_t)rl->max * sizeof(int), M_RACE, M_WAITOK);
+    rl->count = race_reg_snapshot(&race_units, &rl->cursor, units, rl->max);
+    error = copyout(units, (void *)(uintptr_t)rl->units,
+                    (size_t)rl->count * sizeof(int));
+    free(units, M_RACE);
+    return (error);
+}
+
+/* debug.race_units, the attached units for sysctl(8), one page at a time */
+static int
+race_sysctl_units(SYSCTL_HANDLER_ARGS)
+{
+    struct sbuf *sb;
+    int *units, cursor = 0, error;
+    unsigned int i, n;
+    error = sysctl_wire_old_buffer(req, 0);
+    if (error != 0)
+        return (error);
+    sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+    units = malloc(RACE_LIST_PAGE * sizeof(int), M_RACE, M_WAITOK);
+    sbuf_printf(sb, "%u units\n", race_units.count);
+    do {
+        n = race_reg_snapshot(&race_units, &cursor, units, RACE_LIST_PAGE);
+        for (i = 0; i < n; i++)
+            sbuf_printf(sb, " %d\n", units[i]);
+    } while (cursor >= 0);
+    free(units, M_RACE);
+    error = sbuf_finish(sb);
+    sbuf_delete(sb);
+    return (error);
+}
+
+/* debug.race_cache, allocations from race_zone */
+static int
+race_sysctl_cache(SYSCTL_HANDLER_ARGS)
+{
+    struct sbuf *sb;
+    uint64_t allocs, frees, slab_items;
+    int error;
+    error = sysctl_wire_old_buffer(req, 0);
+    if (error != 0)
+        return (error);
+    sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+    allocs = counter_u64_fetch(race_allocs);
+    frees = counter_u64_fetch(race_frees);
+    slab_items = counter_u64_fetch(race_slab_items);
+    sbuf_printf(sb, "\n      allocs        frees       in_use   slab_items\n");
+    sbuf_printf(sb, "%12ju %12ju %12ju %12ju\n", (uintmax_t)allocs,
+                (uintmax_t)frees, (uintmax_t)(allocs - frees),
+                (uintmax_t)slab_items);
+    error = sbuf_finish(sb);
+    sbuf_delete(sb);
+    return (error);
+}
+
+static int
+race_zinit(void *mem __unused, int size __unused, int flags __unused)
+{
+    counter_u64_add(race_slab_items, 1);
+    return (0);
+}
+
 static struct race_softc *
-race_new(void)
+race_alloc(void)
 {
     struct race_softc *sc;
-    int unit, max = -1;
-    LIST_FOREACH(sc, &race_list, list) {
-    if (sc->unit > max)
-        max = sc->unit;
-    }
-    unit = max + 1;
-    sc = (struct race_softc *)malloc(sizeof(struct race_softc), M_RACE, M_WAITOK | M_ZERO);
-    sc->unit = unit;
-    LIST_INSERT_HEAD(&race_list, sc, list);
+    sc = uma_zalloc(race_zone, M_WAITOK | M_ZERO);
+    counter_u64_add(race_allocs, 1);
     return (sc);
 }
 
-static struct race_softc
-*race_find(int unit)
+static int
+race_new(struct race_softc **scp)
 {
     struct race_softc *sc;
-    LIST_FOREACH(sc, &race_list, list) {
-    if (sc->unit == unit)
-        break;
+    int error;
+    sc = race_alloc();
+    error = race_reg_insert(&race_units, sc, &sc->unit);
+    if (error != 0) {
+        race_free(sc);
+        return (error);
     }
-    return (sc);
+    *scp = sc;
+    return (0);
+}
+
+static struct race_softc
+*race_find(int unit)
+{
+    return (race_reg_find(&race_units, unit));
 }
 
 static void
 race_destroy(struct race_softc *sc)
 {
-    LIST_REMOVE(sc, list);
-    free(sc, M_RACE);
+    race_reg_remove(&race_units, sc->unit);
+    epoch_call(race_epoch, race_free_epoch, &sc->ctx);
+}
+
+static void
+race_free(void *sc)
+{
+    uma_zfree(race_zone, sc);
+    counter_u64_add(race_frees, 1);
+}
+
+static void
+race_free_epoch(epoch_context_t ctx)
+{
+    race_free(__containerof(ctx, struct race_softc, ctx));
 }
 
 static int
 race_modevent(module_t mod __unused, int event, void *arg __unused)
 {
-    struct race_softc *sc, *sc_temp;
     int error = 0;
     switch (event) {
     case MOD_LOAD:
         mtx_init(&race_mtx, "race config lock", NULL, MTX_DEF);
+        race_epoch = epoch_alloc("race", EPOCH_PREEMPT);
+        race_allocs = counter_u64_alloc(M_WAITOK);
+        race_frees = counter_u64_alloc(M_WAITOK);
+        race_slab_items = counter_u64_alloc(M_WAITOK);
+        race_zone = uma_zcreate("race_softc", sizeof(struct race_softc),
+                                NULL, NULL, race_zinit, NULL,
+                                UMA_ALIGN_CACHE, 0);
         race_dev = make_dev(&race_cdevsw, 0, UID_ROOT, GID_WHEEL,
                             0600, RACE_NAME);
         uprintf("Race driver loaded.\n");
@@ -135,19 +378,20 @@ race_modevent(module_t mod __unused, int event, void *arg __unused)
     case MOD_UNLOAD:
         destroy_dev(race_dev);
         mtx_lock(&race_mtx);
-        if (!LIST_EMPTY(&race_list)) {
-            LIST_FOREACH_SAFE(sc, &race_list, list, sc_temp) {
-                LIST_REMOVE(sc, list);
-                free(sc, M_RACE);
-            }
-        }
+        race_reg_destroy(&race_units, race_free);
         mtx_unlock(&race_mtx);
+        epoch_drain_callbacks(race_epoch);
+        epoch_free(race_epoch);
+        uma_zdestroy(race_zone);
+        counter_u64_free(race_slab_items);
+        counter_u64_free(race_frees);
+        counter_u64_free(race_allocs);
         mtx_destroy(&race_mtx);
         uprintf("Race driver unloaded.\n");
         break;
     case MOD_QUIESCE:
         mtx_lock(&race_mtx);
-        if (!LIST_EMPTY(&race_list)) {
+        if (race_units.count != 0) {
             error = EBUSY;
         }
         mtx_unlock(&race_mtx);
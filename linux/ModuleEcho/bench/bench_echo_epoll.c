@@ -0,0 +1,167 @@
+/*
+ * Fan-out of one echo message to many epoll waiters, module loaded
+ * with shared=1. N files of /dev/echo are spread over T threads, each
+ * with its own epoll instance. Every round the writer sends a burst
+ * of B messages and waits until every file has read the last one.
+ * Reported are rounds/s, the time for a round to reach all files and
+ * the epoll_wait wakeups and reads per file and round; with coalesced
+ * wakeups a burst should not cost B of each.
+ *
+ *   ./bench_echo_epoll [files] [threads] [rounds] [burst] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+struct waiter {
+    pthread_t thread;
+    int epfd;
+    int first, nr;      /* its files are fds[first .. first + nr) */
+    long wakeups;
+    long reads;
+};
+
+static const char *dev = "/dev/echo";
+static int *fds;
+static uint32_t *done_round;   /* per file, last complete round it read */
+static uint32_t target;        /* round whose last message counts */
+static long remaining;         /* files still to read target */
+static volatile int stop;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+/* Messages are the round and its index in the burst */
+static void *waiter_fn(void *arg)
+{
+    struct waiter *w = arg;
+    struct epoll_event ev[256];
+    uint32_t msg[2];
+    int n, i;
+
+    while (!stop) {
+        n = epoll_wait(w->epfd, ev, 256, 100);
+        if (n < 0)
+            die("epoll_wait");
+        if (n > 0)
+            w->wakeups++;
+        for (i = 0; i < n; i++) {
+            int idx = ev[i].data.u32;
+
+            if (pread(fds[idx], msg, sizeof(msg), 0) != sizeof(msg))
+                continue;
+            w->reads++;
+            if (msg[0] == __atomic_load_n(&target, __ATOMIC_ACQUIRE) &&
+                msg[1] == UINT32_MAX && done_round[idx] != msg[0]) {
+                done_round[idx] = msg[0];
+                __atomic_sub_fetch(&remaining, 1, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int nfiles = argc > 1 ? atoi(argv[1]) : 10000;
+    int nthreads = argc > 2 ? atoi(argv[2]) : 4;
+    int rounds = argc > 3 ? atoi(argv[3]) : 200;
+    int burst = argc > 4 ? atoi(argv[4]) : 16;
+    struct rlimit rl = { nfiles + 64, nfiles + 64 };
+    struct waiter *waiters;
+    double t, fanout = 0;
+    long wakeups = 0, reads = 0;
+    uint32_t msg[2];
+    int wfd, i, r, b;
+
+    if (argc > 5)
+        dev = argv[5];
+    if (nthreads < 1 || nfiles < nthreads || burst < 1) {
+        fprintf(stderr, "need files >= threads >= 1 and burst >= 1\n");
+        return 1;
+    }
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+        die("setrlimit RLIMIT_NOFILE");
+
+    fds = calloc(nfiles, sizeof(*fds));
+    done_round = calloc(nfiles, sizeof(*done_round));
+    waiters = calloc(nthreads, sizeof(*waiters));
+    if (fds == NULL || done_round == NULL || waiters == NULL)
+        die("calloc");
+    wfd = open(dev, O_WRONLY);
+    if (wfd < 0)
+        die(dev);
+
+    for (i = 0; i < nthreads; i++) {
+        struct waiter *w = &waiters[i];
+        int j;
+
+        w->first = (long)nfiles * i / nthreads;
+        w->nr = (long)nfiles * (i + 1) / nthreads - w->first;
+        w->epfd = epoll_create1(0);
+        if (w->epfd < 0)
+            die("epoll_create1");
+        for (j = w->first; j < w->first + w->nr; j++) {
+            struct epoll_event ev = { .events = EPOLLIN, .data.u32 = j };
+
+            fds[j] = open(dev, O_RDONLY);
+            if (fds[j] < 0)
+                die(dev);
+            if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fds[j], &ev) < 0)
+                die("epoll_ctl");
+        }
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&waiters[i].thread, NULL, waiter_fn, &waiters[i]);
+
+    t = now();
+    for (r = 1; r <= rounds; r++) {
+        double start = now();
+
+        __atomic_store_n(&remaining, nfiles, __ATOMIC_RELAXED);
+        __atomic_store_n(&target, r, __ATOMIC_RELEASE);
+        for (b = 0; b < burst; b++) {
+            msg[0] = r;
+            msg[1] = b == burst - 1 ? UINT32_MAX : (uint32_t)b;
+            if (pwrite(wfd, msg, sizeof(msg), 0) != sizeof(msg))
+                die("pwrite");
+        }
+        while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE) > 0)
+            sched_yield();
+        fanout += now() - start;
+    }
+    t = now() - t;
+
+    stop = 1;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(waiters[i].thread, NULL);
+        wakeups += waiters[i].wakeups;
+        reads += waiters[i].reads;
+    }
+
+    printf("files %d threads %d burst %d\n", nfiles, nthreads, burst);
+    printf("%12s %14s %18s %16s\n", "rounds/s", "fanout_us", "wakeups/round",
+           "reads/file/round");
+    printf("%12.0f %14.1f %18.1f %16.2f\n", rounds / t, fanout / rounds * 1e6,
+           (double)wakeups / rounds, (double)reads / nfiles / rounds);
+    return 0;
+}
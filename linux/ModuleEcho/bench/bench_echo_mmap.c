@@ -0,0 +1,132 @@
+/*
+ * Inspecting the echo message through read(2) against polling a
+ * read-only mapping of it. Both sides sum the whole message; read(2)
+ * copies it first, the mapping reader checks the header generation
+ * around its pass instead.
+ *
+ *   ./bench_echo_mmap [max_mib] [seconds_per_size] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "echo_ioctl.h"
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static uint64_t sum(const void *p, size_t len)
+{
+    const uint64_t *w = p;
+    uint64_t s = 0;
+    size_t i;
+
+    for (i = 0; i < len / 8; i++)
+        s += w[i];
+    return s;
+}
+
+/* One consistent pass over the mapped message, seqcount style */
+static uint64_t map_sum(const struct echo_map_header *hdr, size_t *retries)
+{
+    const char *data = (const char *)hdr + hdr->data_offset;
+    uint64_t gen, s;
+
+    for (;;) {
+        gen = __atomic_load_n(&hdr->generation, __ATOMIC_ACQUIRE);
+        if (gen & 1) {
+            (*retries)++;
+            continue;
+        }
+        s = sum(data, __atomic_load_n(&hdr->length, __ATOMIC_RELAXED));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&hdr->generation, __ATOMIC_RELAXED) == gen)
+            return s;
+        (*retries)++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t max = (argc > 1 ? atol(argv[1]) : 64) << 20;
+    double seconds = argc > 2 ? atof(argv[2]) : 1;
+    const char *dev = argc > 3 ? argv[3] : "/dev/echo";
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size, retries = 0;
+    volatile uint64_t sink;
+    char *out, *in;
+    int fd;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0)
+        die(dev);
+    out = malloc(max);
+    in = malloc(max);
+    if (out == NULL || in == NULL)
+        die("malloc");
+    memset(out, 'm', max);
+
+    printf("%12s %14s %14s %14s %14s\n", "size", "read_ops/s", "mmap_ops/s",
+           "read_MB/s", "mmap_MB/s");
+    for (size = 4096; size <= max; size <<= 2) {
+        struct echo_map_header *hdr;
+        double t, read_ops, map_ops;
+        int isize = size;
+        long n;
+
+        if (ioctl(fd, ECHO_SET_BUFFER_SIZE, &isize) < 0)
+            die("ECHO_SET_BUFFER_SIZE");
+        if (pwrite(fd, out, size, 0) != (ssize_t)size)
+            die("pwrite");
+        hdr = mmap(NULL, page + size, PROT_READ, MAP_SHARED, fd, 0);
+        if (hdr == MAP_FAILED)
+            die("mmap");
+        if (hdr->length != size || hdr->generation & 1) {
+            fprintf(stderr, "bad header at size %zu\n", size);
+            return 1;
+        }
+
+        t = now();
+        for (n = 0; now() - t < seconds; n++) {
+            if (pread(fd, in, size, 0) != (ssize_t)size)
+                die("pread");
+            sink = sum(in, size);
+        }
+        read_ops = n / (now() - t);
+
+        t = now();
+        for (n = 0; now() - t < seconds; n++)
+            sink = map_sum(hdr, &retries);
+        map_ops = n / (now() - t);
+
+        if (sink != sum(out, size)) {
+            fprintf(stderr, "checksum mismatch at size %zu\n", size);
+            return 1;
+        }
+        printf("%12zu %14.0f %14.0f %14.0f %14.0f\n", size, read_ops, map_ops,
+               read_ops * size / 1e6, map_ops * size / 1e6);
+        munmap(hdr, page + size);
+    }
+
+    free(in);
+    free(out);
+    close(fd);
+    return 0;
+}
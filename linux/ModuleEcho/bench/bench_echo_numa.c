@@ -0,0 +1,150 @@
+/*
+ * Bandwidth of one echo context for every NUMA node it is placed on.
+ * Every cycle writes the whole buffer, reads it back and scans it
+ * through a read-only mapping; a buffer on a remote node should show
+ * in all three.
+ *
+ *   ./bench_echo_numa [-m mib] [-t seconds] [-n node,...] [-d device]
+ *
+ *   -n  nodes to place the buffer on, -1 for the writer's (the default)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "echo_ioctl.h"
+
+#define MAX_NODES   64
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void *user_buffer(size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+        die("mmap");
+    return p;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dev = "/dev/echo";
+    size_t size = 256 << 20;
+    double seconds = 1;
+    int nodes[MAX_NODES] = { ECHO_NODE_WRITER }, nr_nodes = 1;
+    int opt, n;
+    char *out, *in, *s;
+    long page = sysconf(_SC_PAGESIZE);
+
+    while ((opt = getopt(argc, argv, "m:t:n:d:")) != -1) {
+        switch (opt) {
+        case 'm': size = (size_t)atol(optarg) << 20; break;
+        case 't': seconds = atof(optarg); break;
+        case 'n':
+            for (nr_nodes = 0, s = strtok(optarg, ",");
+                 s != NULL && nr_nodes < MAX_NODES; s = strtok(NULL, ","))
+                nodes[nr_nodes++] = atoi(s);
+            break;
+        case 'd': dev = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-m mib] [-t seconds] [-n node,...] "
+                    "[-d device]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (size == 0 || size > INT32_MAX || nr_nodes == 0) {
+        fprintf(stderr, "bad size or node list\n");
+        return 1;
+    }
+
+    out = user_buffer(size);
+    in = user_buffer(size);
+    memset(out, 'n', size);
+    memset(in, 0, size);
+
+    printf("%4s %9s %10s %10s %10s\n", "node", "data_node", "write_GB/s",
+           "read_GB/s", "mmap_GB/s");
+    for (n = 0; n < nr_nodes; n++) {
+        struct echo_alloc a = { .node = nodes[n] };
+        double t_write = 0, t_read = 0, t_map = 0, start, t;
+        volatile uint64_t sink = 0;
+        int isize = size, fd;
+        long cycles = 0;
+        uint64_t *map;
+        size_t i;
+
+        fd = open(dev, O_RDWR);
+        if (fd < 0)
+            die(dev);
+        if (ioctl(fd, ECHO_SET_BUFFER_SIZE, &isize) < 0)
+            die("ECHO_SET_BUFFER_SIZE");
+        if (ioctl(fd, ECHO_SET_ALLOC, &a) < 0) {
+            printf("%4d %9s  (%s)\n", nodes[n], "-", strerror(errno));
+            close(fd);
+            continue;
+        }
+        /* the first write places a writer's node buffer */
+        if (pwrite(fd, out, size, 0) != (ssize_t)size)
+            die("pwrite");
+        if (ioctl(fd, ECHO_GET_ALLOC, &a) < 0)
+            die("ECHO_GET_ALLOC");
+        map = mmap(NULL, page + size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+            die("mmap");
+
+        start = now();
+        do {
+            t = now();
+            if (pwrite(fd, out, size, 0) != (ssize_t)size)
+                die("pwrite");
+            t_write += now() - t;
+
+            t = now();
+            if (pread(fd, in, size, 0) != (ssize_t)size)
+                die("pread");
+            t_read += now() - t;
+
+            t = now();
+            for (i = page / 8; i < (page + size) / 8; i += 8)
+                sink += map[i];
+            t_map += now() - t;
+            cycles++;
+        } while (now() - start < seconds);
+
+        if (memcmp(in, out, size) != 0) {
+            fprintf(stderr, "data mismatch, node %d\n", nodes[n]);
+            return 1;
+        }
+        printf("%4d %9d %10.2f %10.2f %10.2f\n", nodes[n], a.data_node,
+               size * cycles / t_write / 1e9, size * cycles / t_read / 1e9,
+               size * cycles / t_map / 1e9);
+
+        munmap(map, page + size);
+        close(fd);
+    }
+
+    munmap(in, size);
+    munmap(out, size);
+    return 0;
+}
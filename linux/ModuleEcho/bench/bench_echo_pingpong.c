@@ -0,0 +1,294 @@
+/*
+ * Round-trip latency through the echo device. Two processes pinned to
+ * the given CPUs bounce a message over two queue mode contexts, ping
+ * and pong, opened before fork() so both sides share them. Messages
+ * of 8 bytes or more carry the sender's CLOCK_MONOTONIC timestamp, the
+ * receiver derives the one-way latency from it. Reported per size are
+ * min/p50/p99/p999/max of the round trip and the one-way time, as a
+ * table or with -j as one JSON document per run. The module must be
+ * loaded without shared=1, with it ping and pong would be one queue.
+ *
+ *   ./bench_echo_pingpong [-a cpu] [-b cpu] [-n iterations] [-m max_size]
+ *                         [-s] [-j] [-d device]
+ *
+ *   -s  spin on O_NONBLOCK reads instead of sleeping in read(2)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#include "echo_ioctl.h"
+
+#define WARMUP      1000
+
+static int spin;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        die("sched_setaffinity");
+}
+
+static int open_queue(const char *dev, size_t max_size)
+{
+    struct echo_mode mode = { .mode = ECHO_MODE_QUEUE, .depth = 4 };
+    int size = max_size < 128 ? 128 : max_size;
+    int fd;
+
+    fd = open(dev, O_RDWR | (spin ? O_NONBLOCK : 0));
+    if (fd < 0)
+        die(dev);
+    if (ioctl(fd, ECHO_SET_BUFFER_SIZE, &size) < 0)
+        die("ECHO_SET_BUFFER_SIZE");
+    if (ioctl(fd, ECHO_SET_MODE, &mode) < 0)
+        die("ECHO_SET_MODE");
+    return fd;
+}
+
+/* A message sent on ping must not show up on pong */
+static void check_private(int ping, int pong)
+{
+    int flags = fcntl(pong, F_GETFL);
+    char c = 'p';
+    ssize_t n;
+
+    if (flags < 0 || fcntl(pong, F_SETFL, flags | O_NONBLOCK) < 0)
+        die("fcntl");
+    if (write(ping, &c, 1) != 1)
+        die("write");
+    n = read(pong, &c, 1);
+    if (n >= 0 || errno != EAGAIN) {
+        fprintf(stderr, "ping and pong share a queue, load the module "
+                "without shared=1\n");
+        exit(1);
+    }
+    if (read(ping, &c, 1) != 1)
+        die("read");
+    if (fcntl(pong, F_SETFL, flags) < 0)
+        die("fcntl");
+}
+
+static void send_msg(int fd, char *buf, size_t size)
+{
+    uint64_t t;
+
+    if (size >= 8) {
+        t = now_ns();
+        memcpy(buf, &t, 8);
+    }
+    if (write(fd, buf, size) != (ssize_t)size)
+        die("write");
+}
+
+/* Returns the one-way latency, 0 when the message is too short */
+static uint64_t recv_msg(int fd, char *buf, size_t size)
+{
+    uint64_t t;
+    ssize_t n;
+
+    for (;;) {
+        n = read(fd, buf, size);
+        if (n == (ssize_t)size)
+            break;
+        if (n < 0 && errno == EAGAIN)
+            continue;
+        die("read");
+    }
+    if (size < 8)
+        return 0;
+    memcpy(&t, buf, 8);
+    return now_ns() - t;
+}
+
+/* Sizes go up by 4x from 1 byte, the last step is max_size itself */
+static size_t next_size(size_t size, size_t max_size)
+{
+    if (size == max_size)
+        return max_size + 1;
+    return size * 4 < max_size ? size * 4 : max_size;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+struct dist {
+    uint64_t min, p50, p99, p999, max;
+};
+
+static void distribution(uint64_t *v, long n, struct dist *d)
+{
+    qsort(v, n, sizeof(*v), cmp_u64);
+    d->min = v[0];
+    d->p50 = v[(long)(0.5 * (n - 1))];
+    d->p99 = v[(long)(0.99 * (n - 1))];
+    d->p999 = v[(long)(0.999 * (n - 1))];
+    d->max = v[n - 1];
+}
+
+static void print_json_dist(const char *name, const struct dist *d, int valid)
+{
+    if (!valid) {
+        printf("\"%s\": null", name);
+        return;
+    }
+    printf("\"%s\": {\"min\": %llu, \"p50\": %llu, \"p99\": %llu, "
+           "\"p999\": %llu, \"max\": %llu}", name,
+           (unsigned long long)d->min, (unsigned long long)d->p50,
+           (unsigned long long)d->p99, (unsigned long long)d->p999,
+           (unsigned long long)d->max);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dev = "/dev/echo";
+    long iterations = 100000;
+    size_t max_size = 1 << 20, size;
+    int cpu_a = -1, cpu_b = -1, json = 0, first = 1;
+    uint64_t *rtt, *oneway;
+    struct utsname uts;
+    int ping, pong, opt;
+    char *buf;
+
+    while ((opt = getopt(argc, argv, "a:b:n:m:sjd:")) != -1) {
+        switch (opt) {
+        case 'a': cpu_a = atoi(optarg); break;
+        case 'b': cpu_b = atoi(optarg); break;
+        case 'n': iterations = atol(optarg); break;
+        case 'm': max_size = atol(optarg); break;
+        case 's': spin = 1; break;
+        case 'j': json = 1; break;
+        case 'd': dev = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-a cpu] [-b cpu] [-n iterations] "
+                    "[-m max_size] [-s] [-j] [-d device]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1 || max_size < 1) {
+        fprintf(stderr, "iterations and max_size must be positive\n");
+        return 1;
+    }
+
+    ping = open_queue(dev, max_size);
+    pong = open_queue(dev, max_size);
+    check_private(ping, pong);
+    buf = malloc(max_size);
+    rtt = malloc(iterations * sizeof(*rtt));
+    /* the pong side writes its one-way samples where we can see them */
+    oneway = mmap(NULL, iterations * sizeof(*oneway), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (buf == NULL || rtt == NULL || oneway == MAP_FAILED)
+        die("alloc");
+    memset(buf, 'p', max_size);
+    uname(&uts);
+
+    if (json)
+        printf("{\"device\": \"%s\", \"kernel\": \"%s\", \"cpu_a\": %d, "
+               "\"cpu_b\": %d, \"wait\": \"%s\", \"results\": [",
+               dev, uts.release, cpu_a, cpu_b, spin ? "spin" : "block");
+    else
+        printf("%9s %8s %9s %9s %9s %9s %10s %11s %11s\n", "size", "iters",
+               "min_ns", "p50_ns", "p99_ns", "p999_ns", "max_ns",
+               "1way_p50", "1way_p99");
+
+    for (size = 1; size <= max_size; size = next_size(size, max_size)) {
+        long iters = size <= 4096 ? iterations : iterations * 4096 / (long)size;
+        struct dist r, o;
+        pid_t pid;
+        long i;
+
+        if (iters < 100)
+            iters = iterations < 100 ? iterations : 100;
+
+        pid = fork();
+        if (pid < 0)
+            die("fork");
+        if (pid == 0) {
+            pin(cpu_b);
+            for (i = 0; i < WARMUP + iters; i++) {
+                uint64_t ow = recv_msg(ping, buf, size);
+
+                if (i >= WARMUP)
+                    oneway[i - WARMUP] = ow;
+                send_msg(pong, buf, size);
+            }
+            _exit(0);
+        }
+
+        pin(cpu_a);
+        for (i = 0; i < WARMUP + iters; i++) {
+            uint64_t t = now_ns();
+
+            send_msg(ping, buf, size);
+            recv_msg(pong, buf, size);
+            if (i >= WARMUP)
+                rtt[i - WARMUP] = now_ns() - t;
+        }
+        waitpid(pid, NULL, 0);
+
+        distribution(rtt, iters, &r);
+        distribution(oneway, iters, &o);
+        if (json) {
+            printf("%s{\"size\": %zu, \"iterations\": %ld, ", first ? "" : ", ",
+                   size, iters);
+            print_json_dist("rtt_ns", &r, 1);
+            printf(", ");
+            print_json_dist("oneway_ns", &o, size >= 8);
+            printf("}");
+            first = 0;
+        } else {
+            printf("%9zu %8ld %9llu %9llu %9llu %9llu %10llu", size, iters,
+                   (unsigned long long)r.min, (unsigned long long)r.p50,
+                   (unsigned long long)r.p99, (unsigned long long)r.p999,
+                   (unsigned long long)r.max);
+            if (size >= 8)
+                printf(" %11llu %11llu\n", (unsigned long long)o.p50,
+                       (unsigned long long)o.p99);
+            else
+                printf(" %11s %11s\n", "-", "-");
+        }
+        fflush(stdout);
+    }
+    if (json)
+        printf("]}\n");
+
+    munmap(oneway, iterations * sizeof(*oneway));
+    free(rtt);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Message throughput of the echo queue mode with P producer and C
+ * consumer threads on one file. Consumers either read(2) one message
+ * at a time or take batches with ECHO_DEQUEUE_BATCH. Every producer
+ * numbers its messages and the consumers check nothing was lost.
+ *
+ *   ./bench_echo_queue [messages_per_producer] [msg_size] [depth] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "echo_ioctl.h"
+
+#define POISON_LEN  1       /* real messages are at least 8 bytes */
+#define BATCH_MAX   64
+
+static int fd;
+static long count = 200000;
+static size_t msg_size = 64;
+static int batch;
+static uint64_t received;
+static uint64_t checksum;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void *producer_fn(void *arg)
+{
+    char msg[65536];
+    uint64_t seq;
+
+    memset(msg, 'q', msg_size);
+    for (seq = 1; seq <= (uint64_t)count; seq++) {
+        memcpy(msg, &seq, 8);
+        if (write(fd, msg, msg_size) != (ssize_t)msg_size)
+            die("write");
+    }
+    (void)arg;
+    return NULL;
+}
+
+/* Returns 0 on the poison message */
+static int consume(const char *msg, uint32_t len, uint64_t *n, uint64_t *sum)
+{
+    uint64_t seq;
+
+    if (len == POISON_LEN)
+        return 0;
+    memcpy(&seq, msg, 8);
+    (*n)++;
+    *sum += seq;
+    return 1;
+}
+
+static void *consumer_fn(void *arg)
+{
+    size_t buf_len = batch ? BATCH_MAX * msg_size : msg_size;
+    char *buf = malloc(buf_len), poison = 0;
+    uint32_t lens[BATCH_MAX];
+    uint64_t n = 0, sum = 0;
+    int run = 1;
+
+    if (buf == NULL)
+        die("malloc");
+    while (run) {
+        if (batch) {
+            struct echo_batch b = {
+                .buf = (uintptr_t)buf,
+                .lens = (uintptr_t)lens,
+                .buf_len = buf_len,
+                .max_msgs = batch,
+            };
+            size_t off = 0;
+            uint32_t i;
+
+            if (ioctl(fd, ECHO_DEQUEUE_BATCH, &b) < 0)
+                die("ECHO_DEQUEUE_BATCH");
+            for (i = 0; i < b.count; i++) {
+                if (!run) {
+                    /* a poison meant for another consumer, pass it on */
+                    if (write(fd, &poison, POISON_LEN) != POISON_LEN)
+                        die("write poison");
+                    continue;
+                }
+                run = consume(buf + off, lens[i], &n, &sum);
+                off += lens[i];
+            }
+        } else {
+            ssize_t len = read(fd, buf, buf_len);
+
+            if (len < 0)
+                die("read");
+            run = consume(buf, len, &n, &sum);
+        }
+    }
+
+    __atomic_add_fetch(&received, n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&checksum, sum, __ATOMIC_RELAXED);
+    free(buf);
+    (void)arg;
+    return NULL;
+}
+
+static void run(int producers, int consumers)
+{
+    pthread_t threads[64];
+    uint64_t expect_sum = (uint64_t)count * (count + 1) / 2 * producers;
+    char poison = 0;
+    double t;
+    int i;
+
+    received = checksum = 0;
+    t = now();
+    for (i = 0; i < consumers; i++)
+        pthread_create(&threads[producers + i], NULL, consumer_fn, NULL);
+    for (i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer_fn, NULL);
+    for (i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    /* one poison per consumer ends the run */
+    for (i = 0; i < consumers; i++)
+        if (write(fd, &poison, POISON_LEN) != POISON_LEN)
+            die("write poison");
+    for (i = 0; i < consumers; i++)
+        pthread_join(threads[producers + i], NULL);
+    t = now() - t;
+    ioctl(fd, ECHO_CLEAR_BUFFER);
+
+    printf("%4d %4d %6d %14.0f %10s\n", producers, consumers, batch ? batch : 1,
+           received / t,
+           received == (uint64_t)count * producers && checksum == expect_sum ?
+           "ok" : "LOST");
+}
+
+int main(int argc, char **argv)
+{
+    static const int configs[][2] = { {1, 1}, {2, 2}, {4, 4}, {8, 8}, {1, 8}, {8, 1} };
+    struct echo_mode mode = { .mode = ECHO_MODE_QUEUE, .depth = 1024 };
+    const char *dev = "/dev/echo";
+    int size = 65536;
+    unsigned int i;
+
+    if (argc > 1)
+        count = atol(argv[1]);
+    if (argc > 2)
+        msg_size = atol(argv[2]);
+    if (argc > 3)
+        mode.depth = atoi(argv[3]);
+    if (argc > 4)
+        dev = argv[4];
+    if (msg_size < 8 || msg_size > 65536) {
+        fprintf(stderr, "msg_size must be 8 .. 65536\n");
+        return 1;
+    }
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0)
+        die(dev);
+    if (ioctl(fd, ECHO_SET_BUFFER_SIZE, &size) < 0)
+        die("ECHO_SET_BUFFER_SIZE");
+    if (ioctl(fd, ECHO_SET_MODE, &mode) < 0)
+        die("ECHO_SET_MODE");
+
+    printf("%4s %4s %6s %14s %10s\n", "prod", "cons", "batch", "msgs/s", "check");
+    for (batch = 0; batch <= 32; batch += 32)
+        for (i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+            run(configs[i][0], configs[i][1]);
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Stress the lockless read path of the shared echo buffer, module
+ * loaded with shared=1. One writer publishes self-describing messages,
+ * a 4 byte sequence number, a 4 byte length and a payload of that many
+ * copies of the sequence's low byte. N readers pread() the buffer and
+ * check every message they get, a mix of two messages is a torn read.
+ * Every other message is a few pages long with a varying length, so the
+ * check also covers messages that span and end inside a page. Reads
+ * that find the buffer empty are counted apart from the checked ones;
+ * the run fails when nearly every read comes back empty.
+ *
+ *   ./bench_echo_rcu [max_readers] [seconds] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "echo_ioctl.h"
+
+#define HDR_SIZE    8
+#define SMALL_MSG   255
+#define MAX_MSG     (4 * 4096 + 255)
+
+static const char *dev = "/dev/echo";
+static volatile int stop;
+
+struct reader {
+    pthread_t thread;
+    long ops;
+    long empty;
+    long torn;
+};
+
+static int open_dev(void)
+{
+    int fd = open(dev, O_RDWR);
+
+    if (fd < 0) {
+        perror(dev);
+        exit(1);
+    }
+    return fd;
+}
+
+/* A message is valid when its length and every payload byte agree */
+static int check(const unsigned char *buf, ssize_t n)
+{
+    uint32_t seq, len;
+    ssize_t i;
+
+    if (n < HDR_SIZE)
+        return 0;
+    memcpy(&seq, buf, 4);
+    memcpy(&len, buf + 4, 4);
+    if (n != (ssize_t)(HDR_SIZE + len))
+        return 0;
+    for (i = HDR_SIZE; i < n; i++)
+        if (buf[i] != (unsigned char)seq)
+            return 0;
+    return 1;
+}
+
+/*
+ * Without shared=1 every file has its own buffer and the readers would
+ * only ever see it empty, so make sure a write on one file shows up on
+ * another before timing anything.
+ */
+static void check_shared(void)
+{
+    static const char probe[] = "bench_echo_rcu";
+    char buf[sizeof(probe)];
+    int a = open_dev(), b = open_dev();
+
+    if (pwrite(a, probe, sizeof(probe), 0) != sizeof(probe)) {
+        perror("pwrite");
+        exit(1);
+    }
+    if (pread(b, buf, sizeof(buf), 0) != sizeof(probe) ||
+        memcmp(buf, probe, sizeof(probe)) != 0) {
+        fprintf(stderr, "%s: buffer not shared, load the module with "
+                "shared=1\n", dev);
+        exit(1);
+    }
+    close(b);
+    close(a);
+}
+
+static void *writer_fn(void *arg)
+{
+    static unsigned char buf[MAX_MSG];
+    long *writes = arg;
+    uint32_t seq, len;
+    int fd = open_dev();
+
+    for (seq = 1; !stop; seq++) {
+        /*
+         * Vary the length so a mix of two messages shows in the size
+         * too, alternating between single and multi-page messages.
+         */
+        if (seq & 1)
+            len = 16 + seq * 37 % (SMALL_MSG - HDR_SIZE - 16);
+        else
+            len = 4096 + seq * 37 % (MAX_MSG - HDR_SIZE - 4096);
+        memcpy(buf, &seq, 4);
+        memcpy(buf + 4, &len, 4);
+        memset(buf + HDR_SIZE, (unsigned char)seq, len);
+        if (pwrite(fd, buf, HDR_SIZE + len, 0) != (ssize_t)(HDR_SIZE + len)) {
+            perror("pwrite");
+            exit(1);
+        }
+        (*writes)++;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static void *reader_fn(void *arg)
+{
+    struct reader *r = arg;
+    unsigned char buf[MAX_MSG + 1];
+    int fd = open_dev();
+    ssize_t n;
+
+    while (!stop) {
+        n = pread(fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            perror("pread");
+            exit(1);
+        }
+        if (n == 0)
+            r->empty++;
+        else if (!check(buf, n))
+            r->torn++;
+        r->ops++;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int max_readers = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    int seconds = argc > 2 ? atoi(argv[2]) : 2;
+    struct reader *readers;
+    long total_torn = 0, total_reads = 0, total_empty = 0;
+    int n, i, fd, size = MAX_MSG;
+
+    if (argc > 3)
+        dev = argv[3];
+    if (max_readers < 1)
+        max_readers = 1;
+
+    /* the probe is left in the buffer, the clear below removes it */
+    check_shared();
+    fd = open_dev();
+    if (ioctl(fd, ECHO_SET_BUFFER_SIZE, &size) < 0) {
+        perror("ECHO_SET_BUFFER_SIZE");
+        return 1;
+    }
+    if (ioctl(fd, ECHO_CLEAR_BUFFER) < 0) {
+        perror("ECHO_CLEAR_BUFFER");
+        return 1;
+    }
+    close(fd);
+
+    readers = calloc(max_readers, sizeof(*readers));
+    if (readers == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    printf("%8s %14s %16s %14s %10s %8s\n", "readers", "reads/s",
+           "reads/s/reader", "writes/s", "empty", "torn");
+    for (n = 1; n <= max_readers; n <<= 1) {
+        pthread_t writer;
+        long reads = 0, empty = 0, torn = 0, writes = 0;
+
+        memset(readers, 0, n * sizeof(*readers));
+        stop = 0;
+        pthread_create(&writer, NULL, writer_fn, &writes);
+        for (i = 0; i < n; i++)
+            pthread_create(&readers[i].thread, NULL, reader_fn, &readers[i]);
+        sleep(seconds);
+        stop = 1;
+        pthread_join(writer, NULL);
+        for (i = 0; i < n; i++) {
+            pthread_join(readers[i].thread, NULL);
+            reads += readers[i].ops;
+            empty += readers[i].empty;
+            torn += readers[i].torn;
+        }
+        total_reads += reads;
+        total_empty += empty;
+        total_torn += torn;
+
+        printf("%8d %14.0f %16.0f %14.0f %10ld %8ld\n", n,
+               (double)reads / seconds, (double)reads / seconds / n,
+               (double)writes / seconds, empty, torn);
+    }
+
+    free(readers);
+    /* the writer never clears the buffer, only the start can be empty */
+    if (total_empty * 100 > total_reads * 99) {
+        fprintf(stderr, "FAIL: %ld of %ld reads were empty, nothing was "
+                "checked\n", total_empty, total_reads);
+        return 1;
+    }
+    if (total_torn) {
+        fprintf(stderr, "FAIL: %ld torn reads\n", total_torn);
+        return 1;
+    }
+    printf("no torn reads\n");
+    return 0;
+}
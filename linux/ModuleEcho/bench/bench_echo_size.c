@@ -0,0 +1,89 @@
+/*
+ * Write and read bandwidth of one echo context for buffer sizes from
+ * 4 KiB to 256 MiB. Every cycle writes a full buffer and reads it
+ * back, the module must be loaded with max_size of at least the
+ * largest size.
+ *
+ *   ./bench_echo_size [max_mib] [seconds_per_size] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "echo_ioctl.h"
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    size_t max = (argc > 1 ? atol(argv[1]) : 256) << 20;
+    double seconds = argc > 2 ? atof(argv[2]) : 1;
+    const char *dev = argc > 3 ? argv[3] : "/dev/echo";
+    double t_write, t_read, start;
+    char *out, *in;
+    size_t size;
+    long cycles;
+    int fd;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0)
+        die(dev);
+    out = malloc(max);
+    in = malloc(max);
+    if (out == NULL || in == NULL)
+        die("malloc");
+    memset(out, 'e', max);
+    memset(in, 0, max);
+
+    printf("%12s %10s %12s %12s\n", "size", "cycles", "write_MB/s", "read_MB/s");
+    for (size = 4096; size <= max; size <<= 2) {
+        int isize = size;
+
+        if (ioctl(fd, ECHO_SET_BUFFER_SIZE, &isize) < 0)
+            die("ECHO_SET_BUFFER_SIZE");
+
+        t_write = t_read = 0;
+        cycles = 0;
+        start = now();
+        do {
+            double t = now();
+
+            if (pwrite(fd, out, size, 0) != (ssize_t)size)
+                die("pwrite");
+            t_write += now() - t;
+            t = now();
+            if (pread(fd, in, size, 0) != (ssize_t)size)
+                die("pread");
+            t_read += now() - t;
+            cycles++;
+        } while (now() - start < seconds);
+
+        if (memcmp(in, out, size) != 0) {
+            fprintf(stderr, "data mismatch at size %zu\n", size);
+            return 1;
+        }
+        printf("%12zu %10ld %12.0f %12.0f\n", size, cycles,
+               size * cycles / t_write / 1e6, size * cycles / t_read / 1e6);
+    }
+
+    free(in);
+    free(out);
+    close(fd);
+    return 0;
+}
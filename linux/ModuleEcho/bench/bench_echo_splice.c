@@ -0,0 +1,138 @@
+/*
+ * Forwarding the echo message to a socket: pread(2) plus write(2)
+ * against splice(2) from the device into a pipe and on to the socket.
+ * A thread on the other end of a unix socket pair drains everything.
+ *
+ *   ./bench_echo_splice [max_mib] [seconds_per_size] [device]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "echo_ioctl.h"
+
+#define DRAIN_BUF   (1 << 20)
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void *drain_fn(void *arg)
+{
+    int fd = *(int *)arg;
+    char *buf = malloc(DRAIN_BUF);
+
+    if (buf == NULL)
+        die("malloc");
+    while (read(fd, buf, DRAIN_BUF) > 0)
+        ;
+    free(buf);
+    return NULL;
+}
+
+/* Forward size bytes of the message with pread + write */
+static void copy_once(int fd, int out, char *buf, size_t size)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    if (pread(fd, buf, size, 0) != (ssize_t)size)
+        die("pread");
+    while (off < size) {
+        n = write(out, buf + off, size - off);
+        if (n <= 0)
+            die("write");
+        off += n;
+    }
+}
+
+/* The same through a pipe, the data never enters user space */
+static void splice_once(int fd, int out, int pipefd[2], size_t size)
+{
+    loff_t pos = 0;
+    size_t done = 0;
+    ssize_t n, m;
+
+    while (done < size) {
+        n = splice(fd, &pos, pipefd[1], NULL, size - done, SPLICE_F_MOVE);
+        if (n <= 0)
+            die("splice from echo");
+        done += n;
+        while (n > 0) {
+            m = splice(pipefd[0], NULL, out, NULL, n, SPLICE_F_MOVE);
+            if (m <= 0)
+                die("splice to socket");
+            n -= m;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t max = (argc > 1 ? atol(argv[1]) : 16) << 20;
+    double seconds = argc > 2 ? atof(argv[2]) : 1;
+    const char *dev = argc > 3 ? argv[3] : "/dev/echo";
+    int sv[2], pipefd[2], fd;
+    pthread_t drain;
+    size_t size;
+    char *buf;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0)
+        die(dev);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        die("socketpair");
+    if (pipe(pipefd) < 0)
+        die("pipe");
+    buf = malloc(max);
+    if (buf == NULL)
+        die("malloc");
+    memset(buf, 's', max);
+    pthread_create(&drain, NULL, drain_fn, &sv[1]);
+
+    printf("%12s %14s %14s\n", "size", "copy_MB/s", "splice_MB/s");
+    for (size = 4096; size <= max; size <<= 2) {
+        double t, copy_rate, splice_rate;
+        int isize = size;
+        long n;
+
+        if (ioctl(fd, ECHO_SET_BUFFER_SIZE, &isize) < 0)
+            die("ECHO_SET_BUFFER_SIZE");
+        if (pwrite(fd, buf, size, 0) != (ssize_t)size)
+            die("pwrite");
+
+        t = now();
+        for (n = 0; now() - t < seconds; n++)
+            copy_once(fd, sv[0], buf, size);
+        copy_rate = n * size / (now() - t) / 1e6;
+
+        t = now();
+        for (n = 0; now() - t < seconds; n++)
+            splice_once(fd, sv[0], pipefd, size);
+        splice_rate = n * size / (now() - t) / 1e6;
+
+        printf("%12zu %14.0f %14.0f\n", size, copy_rate, splice_rate);
+    }
+
+    shutdown(sv[0], SHUT_WR);
+    pthread_join(drain, NULL);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Echo throughput against the number of client threads. Every thread
+ * opens its own file and loops write + read of a short message, with
+ * per-open contexts the total should grow with the thread count.
+ *
+ *   ./bench_echo_threads [max_threads] [seconds] [msg_size] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+static const char *dev = "/dev/echo";
+static size_t msg_size = 64;
+static volatile int stop;
+
+struct client {
+    pthread_t thread;
+    int id;
+    long ops;
+    long errors;
+};
+
+static void *client_fn(void *arg)
+{
+    struct client *c = arg;
+    char out[512], in[512];
+    int fd = open(dev, O_RDWR);
+
+    if (fd < 0) {
+        perror(dev);
+        exit(1);
+    }
+    memset(out, 'a' + c->id % 26, sizeof(out));
+
+    while (!stop) {
+        if (pwrite(fd, out, msg_size, 0) != (ssize_t)msg_size ||
+            pread(fd, in, msg_size, 0) != (ssize_t)msg_size ||
+            memcmp(in, out, msg_size) != 0)
+            c->errors++;
+        c->ops++;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    int seconds = argc > 2 ? atoi(argv[2]) : 2;
+    struct client *clients;
+    int n, i;
+
+    if (argc > 3)
+        msg_size = atol(argv[3]);
+    if (argc > 4)
+        dev = argv[4];
+    if (msg_size == 0 || msg_size > 255) {
+        fprintf(stderr, "msg_size must be 1 .. 255\n");
+        return 1;
+    }
+
+    clients = calloc(max_threads, sizeof(*clients));
+    if (clients == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    printf("%8s %14s %14s %8s\n", "threads", "ops/s", "ops/s/thread", "errors");
+    for (n = 1; n <= max_threads; n <<= 1) {
+        long ops = 0, errors = 0;
+
+        memset(clients, 0, n * sizeof(*clients));
+        stop = 0;
+        for (i = 0; i < n; i++) {
+            clients[i].id = i;
+            pthread_create(&clients[i].thread, NULL, client_fn, &clients[i]);
+        }
+        sleep(seconds);
+        stop = 1;
+        for (i = 0; i < n; i++) {
+            pthread_join(clients[i].thread, NULL);
+            ops += clients[i].ops;
+            errors += clients[i].errors;
+        }
+
+        printf("%8d %14.0f %14.0f %8ld\n", n, (double)ops / seconds,
+               (double)ops / seconds / n, errors);
+    }
+
+    free(clients);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Cost of building one echo message out of N segments: a single
+ * pwritev() of all of them against N pwrite() calls, each at the
+ * offset where its segment belongs. Both produce the same message,
+ * which is read back and checked.
+ *
+ *   ./bench_echo_writev [iterations] [segment_size] [device]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include "echo_ioctl.h"
+
+#define MAX_SEGS    64
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void check(int fd, const char *expect, size_t len)
+{
+    char *got = malloc(len + 1);
+
+    if (got == NULL)
+        die("malloc");
+    if (pread(fd, got, len + 1, 0) != (ssize_t)len || memcmp(got, expect, len)) {
+        fprintf(stderr, "message mismatch\n");
+        exit(1);
+    }
+    free(got);
+}
+
+int main(int argc, char **argv)
+{
+    long iters = argc > 1 ? atol(argv[1]) : 100000;
+    size_t seg = argc > 2 ? atol(argv[2]) : 64;
+    const char *dev = argc > 3 ? argv[3] : "/dev/echo";
+    struct iovec iov[MAX_SEGS];
+    char *msg;
+    int fd, n, i, size;
+    long it;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0)
+        die(dev);
+    msg = malloc(MAX_SEGS * seg);
+    if (msg == NULL)
+        die("malloc");
+    for (i = 0; i < MAX_SEGS; i++) {
+        memset(msg + i * seg, 'A' + i % 26, seg);
+        iov[i].iov_base = msg + i * seg;
+        iov[i].iov_len = seg;
+    }
+
+    size = MAX_SEGS * seg < 128 ? 128 : MAX_SEGS * seg;
+    if (ioctl(fd, ECHO_SET_BUFFER_SIZE, &size) < 0)
+        die("ECHO_SET_BUFFER_SIZE");
+
+    printf("%6s %10s %14s %14s %8s\n", "segs", "bytes", "writev_ns", "writes_ns",
+           "speedup");
+    for (n = 1; n <= MAX_SEGS; n <<= 1) {
+        size_t len = n * seg;
+        double t_vec, t_seq;
+
+        t_vec = now();
+        for (it = 0; it < iters; it++)
+            if (pwritev(fd, iov, n, 0) != (ssize_t)len)
+                die("pwritev");
+        t_vec = now() - t_vec;
+        check(fd, msg, len);
+
+        t_seq = now();
+        for (it = 0; it < iters; it++)
+            for (i = 0; i < n; i++)
+                if (pwrite(fd, iov[i].iov_base, seg, i * seg) != (ssize_t)seg)
+                    die("pwrite");
+        t_seq = now() - t_seq;
+        check(fd, msg, len);
+
+        printf("%6d %10zu %14.0f %14.0f %8.2f\n", n, len, t_vec / iters * 1e9,
+               t_seq / iters * 1e9, t_seq / t_vec);
+    }
+
+    free(msg);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef _ECHO_IOCTL_H
+#define _ECHO_IOCTL_H
+
+/**
+ * ioctl interface of /dev/echo, the same commands as the FreeBSD driver.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define ECHO_CLEAR_BUFFER       _IO('E', 1)
+#define ECHO_SET_BUFFER_SIZE    _IOW('E', 2, int)
+
+/**
+ * ECHO_MODE_MESSAGE, the default, keeps the last message written.
+ * ECHO_MODE_QUEUE queues every write as a message of up to the buffer
+ * size in a ring of depth slots (a power of two, 0 for the default);
+ * read(2) takes the oldest whole message and fails with EMSGSIZE,
+ * leaving it queued, when it does not fit. Reads and writes block on
+ * an empty or full queue unless the file is O_NONBLOCK. The depth is
+ * fixed by the first switch to queue mode, ECHO_CLEAR_BUFFER empties
+ * the queue.
+ */
+#define ECHO_MODE_MESSAGE       0
+#define ECHO_MODE_QUEUE         1
+
+struct echo_mode {
+    __u32 mode;
+    __u32 depth;
+};
+
+#define ECHO_SET_MODE           _IOW('E', 3, struct echo_mode)
+
+/**
+ * Dequeue up to max_msgs messages in one call. They are packed back to
+ * back into buf, lens receives their lengths and count how many were
+ * taken. Stops early at a message that does not fit in what is left of
+ * buf, blocks until there is at least one message unless O_NONBLOCK.
+ * A message that cannot be copied to buf stays queued, the call fails
+ * with EFAULT only when it was the first one.
+ */
+struct echo_batch {
+    __u64 buf;          /* char * */
+    __u64 lens;         /* __u32 *, max_msgs entries */
+    __u32 buf_len;
+    __u32 max_msgs;
+    __u32 count;        /* out */
+    __u32 pad;
+};
+
+#define ECHO_DEQUEUE_BATCH      _IOWR('E', 4, struct echo_batch)
+
+/**
+ * node is the NUMA node of the buffer, ECHO_NODE_WRITER places it on
+ * the node of the next writer. ECHO_SET_ALLOC moves the message to new
+ * pages on node at once, for ECHO_NODE_WRITER on the next write; in
+ * shared mode it applies to the pages of later messages.
+ * ECHO_GET_ALLOC also reports where the buffer is.
+ */
+#define ECHO_NODE_WRITER        (-1)
+
+struct echo_alloc {
+    __s32 node;
+    __s32 data_node;    /* out, node of the first data page */
+};
+
+#define ECHO_SET_ALLOC          _IOW('E', 5, struct echo_alloc)
+#define ECHO_GET_ALLOC          _IOR('E', 6, struct echo_alloc)
+
+/**
+ * First page of a read-only mmap() of /dev/echo, the message follows
+ * at data_offset. generation is odd while the message changes, read it
+ * with acquire semantics before and after copying the message and
+ * retry unless both reads return the same even value.
+ */
+struct echo_map_header {
+    __u64 generation;
+    __u64 length;
+    __u64 size;
+    __u64 data_offset;
+};
+
+#endif /* _ECHO_IOCTL_H */
@@ -0,0 +1,235 @@
+#ifndef _ECHO_QUEUE_H
+#define _ECHO_QUEUE_H
+
+/**
+ * Bounded multi-producer multi-consumer message ring of the echo
+ * queue mode, D. Vyukov's design.
+ *
+ * Every slot carries a sequence number. A producer may fill slot
+ * pos & mask when its sequence is pos, a consumer may empty it when
+ * it is pos + 1. Producers and consumers claim positions with one
+ * cmpxchg on tail or head, the sequence store that releases a slot is
+ * the only other shared write, so neither side ever takes a lock.
+ *
+ * Messages are kvmalloc'ed by the producer and handed over whole, the
+ * ring only moves pointers.
+ *
+ * A consumer that cannot copy a message out hands it back with
+ * echo_queue_unpop(). It cannot go back to the head of the ring, so it
+ * waits on a short locked list that pops look at first; the list is
+ * empty unless a copy failed and costs one load otherwise.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/wait.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+struct echo_qslot {
+    atomic_long_t seq;
+    u32 len;
+    void *data;
+};
+
+/* A message handed back by a consumer */
+struct echo_qheld {
+    struct list_head list;
+    void *data;
+    u32 len;
+};
+
+struct echo_queue {
+    unsigned long mask;
+    struct echo_qslot *slots;
+    wait_queue_head_t readers;      /* wait for a message */
+    wait_queue_head_t writers;      /* wait for a free slot */
+    spinlock_t held_lock;
+    struct list_head held;          /* handed back, oldest first */
+    atomic_long_t head ____cacheline_aligned_in_smp;
+    atomic_long_t tail ____cacheline_aligned_in_smp;
+};
+
+static inline struct echo_queue *echo_queue_alloc(unsigned int depth)
+{
+    struct echo_queue *q;
+    unsigned int i;
+
+    q = kzalloc(sizeof(*q), GFP_KERNEL);
+    if (q == NULL)
+        return NULL;
+    q->slots = kvmalloc_array(depth, sizeof(*q->slots), GFP_KERNEL);
+    if (q->slots == NULL) {
+        kfree(q);
+        return NULL;
+    }
+    for (i = 0; i < depth; i++)
+        atomic_long_set(&q->slots[i].seq, i);
+    q->mask = depth - 1;
+    init_waitqueue_head(&q->readers);
+    init_waitqueue_head(&q->writers);
+    spin_lock_init(&q->held_lock);
+    INIT_LIST_HEAD(&q->held);
+    return q;
+}
+
+/**
+ * Queue a message, false when the ring is full. The ring owns data
+ * from now on.
+ */
+static inline bool echo_queue_push(struct echo_queue *q, void *data, u32 len)
+{
+    long pos = atomic_long_read(&q->tail);
+    struct echo_qslot *slot;
+    long diff;
+
+    for (;;) {
+        slot = &q->slots[pos & q->mask];
+        diff = atomic_long_read_acquire(&slot->seq) - pos;
+        if (diff == 0) {
+            if (atomic_long_try_cmpxchg_relaxed(&q->tail, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_long_read(&q->tail);
+        }
+    }
+
+    slot->data = data;
+    slot->len = len;
+    atomic_long_set_release(&slot->seq, pos + 1);
+    return true;
+}
+
+/**
+ * Give back a message taken by echo_queue_pop() that could not be
+ * delivered, the next pop returns it. It was taken before anything
+ * still in the ring, so it goes ahead of it.
+ */
+static inline void echo_queue_unpop(struct echo_queue *q, void *data, u32 len)
+{
+    struct echo_qheld *h;
+
+    /* only on a failed copy, the small allocation must not lose data */
+    h = kmalloc(sizeof(*h), GFP_KERNEL | __GFP_NOFAIL);
+    h->data = data;
+    h->len = len;
+    spin_lock(&q->held_lock);
+    list_add(&h->list, &q->held);
+    spin_unlock(&q->held_lock);
+}
+
+/* Take the first handed back message, see echo_queue_pop() */
+static inline int echo_queue_pop_held(struct echo_queue *q, void **datap,
+                                      u32 *lenp, size_t max_len)
+{
+    struct echo_qheld *h;
+    int error = 0;
+
+    spin_lock(&q->held_lock);
+    h = list_first_entry_or_null(&q->held, struct echo_qheld, list);
+    if (h == NULL) {
+        error = -EAGAIN;
+    } else if (h->len > max_len) {
+        *lenp = h->len;
+        error = -EMSGSIZE;
+    } else {
+        list_del(&h->list);
+    }
+    spin_unlock(&q->held_lock);
+    if (error)
+        return error;
+    *datap = h->data;
+    *lenp = h->len;
+    kfree(h);
+    return 0;
+}
+
+/**
+ * Take the oldest message if it is at most max_len bytes. Returns
+ * -EAGAIN when the ring is empty and -EMSGSIZE, leaving the message
+ * queued, when it is too long; *lenp is its length then.
+ */
+static inline int echo_queue_pop(struct echo_queue *q, void **datap, u32 *lenp,
+                                 size_t max_len)
+{
+    long pos;
+    struct echo_qslot *slot;
+    long diff;
+    u32 len;
+    int error;
+
+    if (!list_empty(&q->held)) {
+        error = echo_queue_pop_held(q, datap, lenp, max_len);
+        if (error != -EAGAIN)
+            return error;
+    }
+
+    pos = atomic_long_read(&q->head);
+    for (;;) {
+        slot = &q->slots[pos & q->mask];
+        diff = atomic_long_read_acquire(&slot->seq) - (pos + 1);
+        if (diff == 0) {
+            /* the slot cannot be refilled before head moves past pos */
+            len = slot->len;
+            if (len > max_len) {
+                *lenp = len;
+                return -EMSGSIZE;
+            }
+            if (atomic_long_try_cmpxchg_relaxed(&q->head, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            return -EAGAIN;
+        } else {
+            pos = atomic_long_read(&q->head);
+        }
+    }
+
+    *datap = slot->data;
+    *lenp = len;
+    atomic_long_set_release(&slot->seq, pos + q->mask + 1);
+    return 0;
+}
+
+/* A message is ready at the head */
+static inline bool echo_queue_readable(struct echo_queue *q)
+{
+    long pos = atomic_long_read(&q->head);
+
+    return atomic_long_read_acquire(&q->slots[pos & q->mask].seq) == pos + 1 ||
+           !list_empty(&q->held);
+}
+
+/* A slot is free at the tail */
+static inline bool echo_queue_writable(struct echo_queue *q)
+{
+    long pos = atomic_long_read(&q->tail);
+
+    return atomic_long_read_acquire(&q->slots[pos & q->mask].seq) == pos;
+}
+
+/* Drop every queued message */
+static inline void echo_queue_drain(struct echo_queue *q)
+{
+    void *data;
+    u32 len;
+
+    while (echo_queue_pop(q, &data, &len, U32_MAX) == 0)
+        kvfree(data);
+}
+
+static inline void echo_queue_free(struct echo_queue *q)
+{
+    if (q == NULL)
+        return;
+    echo_queue_drain(q);
+    kvfree(q->slots);
+    kfree(q);
+}
+
+#endif /* _ECHO_QUEUE_H */
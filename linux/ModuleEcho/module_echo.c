@@ -0,0 +1,1518 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/cdev.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/sizes.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/srcu.h>
+#include <linux/log2.h>
+#include <linux/poll.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "echo_ioctl.h"
+#include "echo_queue.h"
+
+/**
+ * Linux port of the FreeBSD echo driver, /dev/echo
+ *
+ * Every open file gets its own echo context, so clients neither see
+ * nor contend on each other's messages. shared=1 restores the FreeBSD
+ * behaviour of one buffer for all openers.
+ *
+ * The shared buffer is never modified in place. A writer builds a new
+ * message and publishes it with rcu_assign_pointer(), readers copy out
+ * whatever message they found under srcu_read_lock(). Readers take no
+ * lock and never see a torn message, writers never wait for readers,
+ * old messages are freed after an SRCU grace period. SRCU rather than
+ * RCU because copy_to_user() may fault and sleep.
+ *
+ * Buffers are made of pages, so they can be as large as max_size and
+ * resizing never copies the data. The same pages can be mapped read
+ * only behind a header page whose generation counter works like a
+ * seqcount, see struct echo_map_header.
+ *
+ * ECHO_SET_MODE switches a context to queue mode, where writes queue
+ * discrete messages in a lock-free ring (echo_queue.h) and reads take
+ * them off in order.
+ *
+ * poll/epoll and SIGIO report a message this file has not read yet,
+ * or in queue mode a non-empty or non-full ring. Pollers arm the
+ * context before they check it and a change wakes them only when it
+ * finds the context armed, so a burst of writes costs one wakeup.
+ *
+ * splice(2) out of the device hands the buffer pages themselves to the
+ * pipe. Shared messages never change, a private buffer copies a page
+ * that is still referenced from a pipe before writing to it.
+ *
+ * ECHO_SET_ALLOC picks the NUMA node of a buffer, by default the node
+ * of the first writer. Pages allocated per node are counted in
+ * /sys/kernel/debug/echo/numa.
+ */
+
+#define ECHO_DEFAULT_SIZE   256
+#define ECHO_MIN_SIZE       128
+#define ECHO_QUEUE_DEPTH    256
+#define ECHO_QUEUE_MAX_DEPTH 65536
+
+static bool shared;
+module_param(shared, bool, S_IRUGO);
+MODULE_PARM_DESC(shared, "All openers share one echo buffer");
+
+static unsigned int max_size = SZ_1G;
+module_param(max_size, uint, S_IRUGO);
+MODULE_PARM_DESC(max_size, "Largest buffer ECHO_SET_BUFFER_SIZE accepts");
+
+/**
+ * Echo data held in individual pages. Growing or shrinking the buffer
+ * allocates or releases pages at the end, the data never moves.
+ */
+struct echo_buf {
+    struct page **pages;
+    unsigned long nr_pages;
+    size_t length;
+    int node;       /* of new pages, NUMA_NO_NODE until the first write */
+};
+
+/* Allocations per node, /sys/kernel/debug/echo/numa */
+struct echo_node_stats {
+    atomic_long_t pages;
+    atomic_long_t remote;       /* landed off the wanted node */
+};
+
+/**
+ * Readiness notification of a context
+ */
+struct echo_notify {
+    wait_queue_head_t wait;
+    struct fasync_struct *fasync;
+    int armed;
+};
+
+/* Every open file of the shared context, for its poll state */
+struct echo_reader {
+    u64 seen;
+};
+
+typedef struct echo {
+    struct mutex lock;
+    size_t buffer_size;
+    struct echo_buf buf;
+    struct page *header;    /* struct echo_map_header, page 0 of mmap */
+    u32 mode;
+    struct echo_queue *queue;   /* set once, by the first ECHO_MODE_QUEUE */
+    struct echo_notify notify;
+    u64 seen;                   /* generation this file read last */
+} echo_t;
+
+/**
+ * One published shared message, immutable once visible to readers.
+ * Its pages are released from a work item, a large message is too
+ * much to free in the SRCU callback.
+ */
+struct echo_msg {
+    struct rcu_head rcu;
+    struct work_struct work;
+    struct echo_buf buf;
+};
+
+static struct kmem_cache *echo_cache;
+static struct workqueue_struct *echo_wq;
+
+static struct echo_msg __rcu *echo_shared;
+static struct page *echo_shared_header;
+static size_t echo_shared_size = ECHO_DEFAULT_SIZE;
+static DEFINE_MUTEX(echo_shared_lock);      /* serializes shared writers */
+static u32 echo_shared_mode;
+static struct echo_queue *echo_shared_queue;
+static struct echo_notify echo_shared_notify;
+static int echo_shared_node = NUMA_NO_NODE;
+DEFINE_STATIC_SRCU(echo_srcu);
+
+static struct echo_node_stats *echo_stats;
+static struct dentry *echo_debug_dir;
+
+static dev_t echo_num;
+static struct cdev echo_cdev;
+static struct class *echo_class;
+
+static void
+echo_buf_trim(struct echo_buf *b, unsigned long nr_pages)
+{
+    while (b->nr_pages > nr_pages)
+        put_page(b->pages[--b->nr_pages]);
+}
+
+/* A zeroed page on b's node, the current one until b has a node */
+static struct page *
+echo_buf_alloc(struct echo_buf *b)
+{
+    int node = b->node == NUMA_NO_NODE ? numa_node_id() : b->node;
+    struct page *page;
+
+    page = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO, 0);
+    if (page == NULL)
+        return NULL;
+    atomic_long_inc(&echo_stats[page_to_nid(page)].pages);
+    if (page_to_nid(page) != node)
+        atomic_long_inc(&echo_stats[node].remote);
+    return page;
+}
+
+/**
+ * Give b nr_pages pages. Only the array of page pointers is
+ * reallocated, the pages that stay keep their data.
+ */
+static int
+echo_buf_resize(struct echo_buf *b, unsigned long nr_pages)
+{
+    struct page **pages;
+    unsigned long i;
+
+    if (nr_pages == b->nr_pages)
+        return 0;
+
+    pages = kvmalloc_array(max(nr_pages, 1UL), sizeof(*pages), GFP_KERNEL);
+    if (pages == NULL)
+        return -ENOMEM;
+    for (i = b->nr_pages; i < nr_pages; i++) {
+        pages[i] = echo_buf_alloc(b);
+        if (pages[i] == NULL) {
+            while (i-- > b->nr_pages)
+                put_page(pages[i]);
+            kvfree(pages);
+            return -ENOMEM;
+        }
+    }
+
+    echo_buf_trim(b, nr_pages);
+    if (b->nr_pages)
+        memcpy(pages, b->pages, b->nr_pages * sizeof(*pages));
+    kvfree(b->pages);
+    b->pages = pages;
+    b->nr_pages = nr_pages;
+    return 0;
+}
+
+/**
+ * Make dst reference the first length bytes of src, the pages are
+ * shared, not copied.
+ */
+static int
+echo_buf_share(struct echo_buf *dst, struct echo_buf *src, size_t length)
+{
+    unsigned long i, nr_pages = DIV_ROUND_UP(length, PAGE_SIZE);
+
+    dst->pages = kvmalloc_array(max(nr_pages, 1UL), sizeof(struct page *),
+                                GFP_KERNEL);
+    if (dst->pages == NULL)
+        return -ENOMEM;
+    for (i = 0; i < nr_pages; i++) {
+        get_page(src->pages[i]);
+        dst->pages[i] = src->pages[i];
+    }
+    dst->nr_pages = nr_pages;
+    dst->length = length;
+    return 0;
+}
+
+static void
+echo_buf_free(struct echo_buf *b)
+{
+    echo_buf_trim(b, 0);
+    kvfree(b->pages);
+    b->pages = NULL;
+    b->length = 0;
+}
+
+/**
+ * Copy len bytes of the iterator to pos, returns the bytes copied.
+ * Callers hold the lock echo_vm_fault() takes, so the copy runs with
+ * page faults disabled and stops short at a source page that is not
+ * present: it may be a mapping of /dev/echo itself. The caller drops
+ * the lock, faults the source in with fault_in_iov_iter_readable() and
+ * copies the rest.
+ */
+static size_t
+echo_buf_from_iter(struct echo_buf *b, loff_t pos, struct iov_iter *from,
+                   size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        size_t off = offset_in_page(pos);
+        size_t n = min_t(size_t, len - done, PAGE_SIZE - off);
+        size_t copied;
+
+        pagefault_disable();
+        copied = copy_page_from_iter(b->pages[pos >> PAGE_SHIFT], off, n, from);
+        pagefault_enable();
+        done += copied;
+        if (copied < n)
+            break;
+        pos += n;
+        cond_resched();
+    }
+    return done;
+}
+
+static size_t
+echo_buf_to_iter(struct echo_buf *b, loff_t pos, struct iov_iter *to,
+                 size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        size_t off = offset_in_page(pos);
+        size_t n = min_t(size_t, len - done, PAGE_SIZE - off);
+        size_t copied;
+
+        copied = copy_page_to_iter(b->pages[pos >> PAGE_SHIFT], off, n, to);
+        done += copied;
+        if (copied < n)
+            break;
+        pos += n;
+        cond_resched();
+    }
+    return done;
+}
+
+/* Zero [from, to), the hole left by a write past the end of the message */
+static void
+echo_buf_zero(struct echo_buf *b, loff_t from, loff_t to)
+{
+    while (from < to) {
+        size_t off = offset_in_page(from);
+        size_t n = min_t(size_t, to - from, PAGE_SIZE - off);
+
+        memset(page_address(b->pages[from >> PAGE_SHIFT]) + off, 0, n);
+        from += n;
+    }
+}
+
+/**
+ * Before the private buffer is written in [from, to), give each page
+ * there that is referenced from outside, a pipe that got it spliced,
+ * a copy of its own. The mappings of a replaced page are zapped so
+ * they fault in the copy.
+ */
+static int
+echo_buf_unshare(struct echo_buf *b, struct address_space *mapping,
+                 loff_t from, loff_t to)
+{
+    unsigned long i;
+
+    for (i = from >> PAGE_SHIFT; (loff_t)i << PAGE_SHIFT < to; i++) {
+        struct page *old = b->pages[i], *new;
+        int mapped = folio_mapcount(page_folio(old));
+
+        /* our reference and one per mapping are expected */
+        if (page_count(old) <= 1 + mapped)
+            continue;
+        new = alloc_pages_node(page_to_nid(old), GFP_KERNEL, 0);
+        if (new == NULL)
+            return -ENOMEM;
+        copy_highpage(new, old);
+        b->pages[i] = new;
+        if (mapped)
+            unmap_mapping_range(mapping, (loff_t)(i + 1) << PAGE_SHIFT,
+                                PAGE_SIZE, 1);
+        put_page(old);
+    }
+    return 0;
+}
+
+/**
+ * Where a write starts, the file position or with O_APPEND the end
+ * of the message. A write ends the message, whatever followed the
+ * written range is dropped, so pwrite() at 0 replaces the message as
+ * before and a writev() of header and payload lands in one piece.
+ */
+static loff_t
+echo_write_pos(struct kiocb *iocb, size_t length)
+{
+    return (iocb->ki_flags & IOCB_APPEND) ? length : iocb->ki_pos;
+}
+
+static struct page *
+echo_header_alloc(void)
+{
+    struct page *page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    struct echo_map_header *hdr;
+
+    if (page == NULL)
+        return NULL;
+    hdr = page_address(page);
+    hdr->size = ECHO_DEFAULT_SIZE;
+    hdr->data_offset = PAGE_SIZE;
+    return page;
+}
+
+/**
+ * Bracket every change of the mapped buffer. The generation is odd
+ * in between, a mapping reader that saw the same even generation
+ * before and after copying the message got a consistent copy.
+ */
+static void
+echo_map_begin(struct page *header)
+{
+    struct echo_map_header *hdr = page_address(header);
+
+    WRITE_ONCE(hdr->generation, hdr->generation + 1);
+    smp_wmb();
+}
+
+static void
+echo_map_end(struct page *header, size_t length, size_t size)
+{
+    struct echo_map_header *hdr = page_address(header);
+
+    WRITE_ONCE(hdr->length, length);
+    WRITE_ONCE(hdr->size, size);
+    smp_wmb();
+    WRITE_ONCE(hdr->generation, hdr->generation + 1);
+}
+
+static u64
+echo_generation(struct page *header)
+{
+    struct echo_map_header *hdr = page_address(header);
+
+    return smp_load_acquire(&hdr->generation);
+}
+
+/* Drop the mapped data pages from the first'th on, they fault back in */
+static void
+echo_map_zap(struct address_space *mapping, unsigned long first)
+{
+    unmap_mapping_range(mapping, (loff_t)(first + 1) << PAGE_SHIFT, 0, 1);
+}
+
+static void
+echo_notify_init(struct echo_notify *n)
+{
+    init_waitqueue_head(&n->wait);
+}
+
+/* Somebody is about to check the context and wait, pairs with the wake */
+static void
+echo_notify_arm(struct echo_notify *n)
+{
+    smp_store_mb(n->armed, 1);
+}
+
+/**
+ * The context changed, wake pollers and signal SIGIO owners if it was
+ * armed since the last wakeup.
+ */
+static void
+echo_notify_wake(struct echo_notify *n, __poll_t events)
+{
+    smp_mb();   /* the change before armed, pairs with echo_notify_arm() */
+    if (!READ_ONCE(n->armed) || !xchg(&n->armed, 0))
+        return;
+    wake_up_interruptible_poll(&n->wait, events);
+    kill_fasync(&n->fasync, SIGIO, (events & EPOLLIN) ? POLL_IN : POLL_OUT);
+}
+
+static struct echo_notify *
+echo_notify_of(struct file *f)
+{
+    echo_t *echo = f->private_data;
+
+    return shared ? &echo_shared_notify : &echo->notify;
+}
+
+static u64 *
+echo_seen_of(struct file *f)
+{
+    if (shared)
+        return &((struct echo_reader *)f->private_data)->seen;
+    return &((echo_t *)f->private_data)->seen;
+}
+
+/* A reader took the message, SIGIO owners want to hear of the next one */
+static void
+echo_notify_read(struct file *f, u64 generation)
+{
+    struct echo_notify *n = echo_notify_of(f);
+
+    WRITE_ONCE(*echo_seen_of(f), generation);
+    if (READ_ONCE(n->fasync))
+        echo_notify_arm(n);
+}
+
+static echo_t *
+echo_alloc(void)
+{
+    echo_t *echo;
+
+    echo = kmem_cache_zalloc(echo_cache, GFP_KERNEL);
+    if (echo == NULL)
+        return NULL;
+
+    echo->buffer_size = ECHO_DEFAULT_SIZE;
+    echo->buf.node = NUMA_NO_NODE;
+    echo->header = echo_header_alloc();
+    if (echo->header == NULL) {
+        kmem_cache_free(echo_cache, echo);
+        return NULL;
+    }
+    if (echo_buf_resize(&echo->buf, DIV_ROUND_UP(echo->buffer_size, PAGE_SIZE))) {
+        put_page(echo->header);
+        kmem_cache_free(echo_cache, echo);
+        return NULL;
+    }
+    mutex_init(&echo->lock);
+    echo_notify_init(&echo->notify);
+    return echo;
+}
+
+static void
+echo_free(echo_t *echo)
+{
+    echo_buf_free(&echo->buf);
+    echo_queue_free(echo->queue);
+    put_page(echo->header);
+    kmem_cache_free(echo_cache, echo);
+}
+
+/**
+ * Move the private buffer to new pages on node, copying the message. The mappings are zapped, they fault in the
+ * new pages.
+ */
+static int
+echo_rebuild(echo_t *echo, struct address_space *mapping, int node)
+{
+    struct echo_buf buf = { .node = node };
+    unsigned long i;
+    int error;
+
+    error = echo_buf_resize(&buf, DIV_ROUND_UP(echo->buffer_size, PAGE_SIZE));
+    if (error)
+        return error;
+    for (i = 0; i < DIV_ROUND_UP(echo->buf.length, PAGE_SIZE); i++) {
+        copy_highpage(buf.pages[i], echo->buf.pages[i]);
+        cond_resched();
+    }
+    buf.length = echo->buf.length;
+
+    echo_map_begin(echo->header);
+    echo_map_zap(mapping, 0);
+    echo_buf_free(&echo->buf);
+    echo->buf = buf;
+    echo_map_end(echo->header, echo->buf.length, echo->buffer_size);
+    return 0;
+}
+
+/**
+ * The first write moves the buffer to the writer's node, pages
+ * allocated later follow it there. Best effort, a buffer that cannot
+ * be moved stays where it is.
+ */
+static void
+echo_place(echo_t *echo, struct address_space *mapping)
+{
+    int node = numa_node_id();
+
+    if (page_to_nid(echo->buf.pages[0]) != node)
+        echo_rebuild(echo, mapping, node);
+    echo->buf.node = node;
+}
+
+static struct echo_msg *
+echo_msg_alloc(size_t length)
+{
+    struct echo_msg *msg;
+
+    msg = kzalloc(sizeof(*msg), GFP_KERNEL);
+    if (msg == NULL)
+        return NULL;
+    msg->buf.node = NUMA_NO_NODE;
+    if (echo_buf_resize(&msg->buf, DIV_ROUND_UP(length, PAGE_SIZE))) {
+        kfree(msg);
+        return NULL;
+    }
+    msg->buf.length = length;
+    return msg;
+}
+
+static void
+echo_msg_free(struct echo_msg *msg)
+{
+    echo_buf_free(&msg->buf);
+    kfree(msg);
+}
+
+static void
+echo_msg_free_work(struct work_struct *work)
+{
+    echo_msg_free(container_of(work, struct echo_msg, work));
+}
+
+static void
+echo_msg_free_rcu(struct rcu_head *rcu)
+{
+    struct echo_msg *msg = container_of(rcu, struct echo_msg, rcu);
+
+    INIT_WORK(&msg->work, echo_msg_free_work);
+    queue_work(echo_wq, &msg->work);
+}
+
+/**
+ * Make msg the shared message, the previous one is freed once every
+ * reader that may still see it has left its SRCU read section. The
+ * first same data pages are the old message's own pages, only the
+ * mappings of the pages after them are dropped.
+ */
+static void
+echo_shared_publish(struct echo_msg *msg, struct address_space *mapping,
+                    unsigned long same)
+{
+    struct echo_msg *old;
+
+    old = rcu_dereference_protected(echo_shared,
+                                    lockdep_is_held(&echo_shared_lock));
+    echo_map_begin(echo_shared_header);
+    rcu_assign_pointer(echo_shared, msg);
+    echo_map_zap(mapping, same);
+    echo_map_end(echo_shared_header, msg->buf.length, echo_shared_size);
+    echo_notify_wake(&echo_shared_notify, EPOLLIN | EPOLLRDNORM);
+    if (old != NULL)
+        call_srcu(&echo_srcu, &old->rcu, echo_msg_free_rcu);
+}
+
+/**
+ * Build the message a write produces from old: whole pages before the
+ * write position are shared with old, the page the write starts in
+ * gets old's bytes before it copied, the rest is new.
+ */
+static ssize_t
+echo_shared_write(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct echo_msg *old, *msg;
+    size_t amount, copied, keep, limit = SIZE_MAX, left;
+    loff_t pos;
+    int error;
+
+again:
+    msg = kzalloc(sizeof(*msg), GFP_KERNEL);
+    if (msg == NULL)
+        return -ENOMEM;
+
+    mutex_lock(&echo_shared_lock);
+    old = rcu_dereference_protected(echo_shared,
+                                    lockdep_is_held(&echo_shared_lock));
+    /* new pages go to the writer's node unless one was set */
+    msg->buf.node = echo_shared_node;
+    pos = echo_write_pos(iocb, old->buf.length);
+    if (pos >= echo_shared_size) {
+        error = -ENOSPC;
+        goto out_unlock;
+    }
+    amount = min3(iov_iter_count(from), (size_t)(echo_shared_size - pos),
+                  limit);
+
+    keep = min_t(size_t, pos, old->buf.length);
+    error = echo_buf_share(&msg->buf, &old->buf, round_down(keep, PAGE_SIZE));
+    if (error)
+        goto out_unlock;
+    error = echo_buf_resize(&msg->buf, DIV_ROUND_UP(pos + amount, PAGE_SIZE));
+    if (error)
+        goto out_unlock;
+    if (offset_in_page(keep))
+        memcpy(page_address(msg->buf.pages[keep >> PAGE_SHIFT]),
+               page_address(old->buf.pages[keep >> PAGE_SHIFT]),
+               offset_in_page(keep));
+
+    copied = echo_buf_from_iter(&msg->buf, pos, from, amount);
+    if (copied < amount) {
+        /*
+         * Nothing is published yet: fault the rest of the source in
+         * and start over, or stop at the first byte that cannot be.
+         */
+        mutex_unlock(&echo_shared_lock);
+        echo_msg_free(msg);
+        left = amount - copied;
+        if (fault_in_iov_iter_readable(from, left) == left) {
+            if (copied == 0)
+                return -EFAULT;
+            limit = copied;
+        }
+        iov_iter_revert(from, copied);
+        goto again;
+    }
+    msg->buf.length = pos + copied;
+    echo_shared_publish(msg, iocb->ki_filp->f_mapping, keep >> PAGE_SHIFT);
+    mutex_unlock(&echo_shared_lock);
+
+    iocb->ki_pos = pos + copied;
+    return copied;
+
+out_unlock:
+    mutex_unlock(&echo_shared_lock);
+    echo_msg_free(msg);
+    return error;
+}
+
+static ssize_t
+echo_shared_read(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct echo_msg *msg;
+    size_t amount = 0, copied;
+    int idx;
+
+    /* odd means a publish in flight, claim the older one to poll again */
+    echo_notify_read(iocb->ki_filp, echo_generation(echo_shared_header) & ~1ULL);
+    idx = srcu_read_lock(&echo_srcu);
+    msg = srcu_dereference(echo_shared, &echo_srcu);
+    if (iocb->ki_pos < msg->buf.length)
+        amount = min_t(size_t, iov_iter_count(to),
+                       msg->buf.length - iocb->ki_pos);
+    copied = echo_buf_to_iter(&msg->buf, iocb->ki_pos, to, amount);
+    srcu_read_unlock(&echo_srcu, idx);
+
+    if (copied == 0 && amount > 0)
+        return -EFAULT;
+    iocb->ki_pos += copied;
+    return copied;
+}
+
+/**
+ * Republish the shared message truncated to size, or empty. The
+ * new message shares the pages it keeps with the old one.
+ */
+static int
+echo_shared_resize(struct address_space *mapping, size_t size, bool clear)
+{
+    struct echo_msg *old, *msg;
+    int error;
+
+    msg = kzalloc(sizeof(*msg), GFP_KERNEL);
+    if (msg == NULL)
+        return -ENOMEM;
+
+    mutex_lock(&echo_shared_lock);
+    old = rcu_dereference_protected(echo_shared,
+                                    lockdep_is_held(&echo_shared_lock));
+    error = echo_buf_share(&msg->buf, &old->buf,
+                           clear ? 0 : min(old->buf.length, size));
+    if (error) {
+        mutex_unlock(&echo_shared_lock);
+        kfree(msg);
+        return error;
+    }
+    echo_shared_size = size;
+    echo_shared_publish(msg, mapping, msg->buf.nr_pages);
+    mutex_unlock(&echo_shared_lock);
+    return 0;
+}
+
+static int
+echo_open(struct inode *inode, struct file *f)
+{
+    if (shared) {
+        f->private_data = kzalloc(sizeof(struct echo_reader), GFP_KERNEL);
+        return f->private_data ? 0 : -ENOMEM;
+    }
+
+    f->private_data = echo_alloc();
+    return f->private_data ? 0 : -ENOMEM;
+}
+
+static int
+echo_release(struct inode *inode, struct file *f)
+{
+    if (shared)
+        kfree(f->private_data);
+    else
+        echo_free(f->private_data);
+    return 0;
+}
+
+/* The queue of f if it is in queue mode, NULL otherwise */
+static struct echo_queue *
+echo_queue_get(struct file *f)
+{
+    echo_t *echo = f->private_data;
+
+    if (shared)
+        return smp_load_acquire(&echo_shared_mode) == ECHO_MODE_QUEUE ?
+            READ_ONCE(echo_shared_queue) : NULL;
+    return smp_load_acquire(&echo->mode) == ECHO_MODE_QUEUE ?
+        READ_ONCE(echo->queue) : NULL;
+}
+
+static size_t
+echo_queue_max_len(struct file *f)
+{
+    echo_t *echo = f->private_data;
+
+    return shared ? READ_ONCE(echo_shared_size) : READ_ONCE(echo->buffer_size);
+}
+
+/**
+ * Pop a message of at most max_len bytes, sleeping while the queue is
+ * empty unless nonblock.
+ */
+static int
+echo_queue_wait_pop(struct echo_queue *q, bool nonblock, void **datap,
+                    u32 *lenp, size_t max_len)
+{
+    int error;
+
+    for (;;) {
+        error = echo_queue_pop(q, datap, lenp, max_len);
+        if (error != -EAGAIN || nonblock)
+            return error;
+        error = wait_event_interruptible(q->readers, echo_queue_readable(q));
+        if (error)
+            return error;
+    }
+}
+
+static bool
+echo_nonblock(struct kiocb *iocb)
+{
+    return (iocb->ki_flags & IOCB_NOWAIT) ||
+           (iocb->ki_filp->f_flags & O_NONBLOCK);
+}
+
+static ssize_t
+echo_queue_write(struct echo_queue *q, struct kiocb *iocb,
+                 struct iov_iter *from)
+{
+    size_t len = iov_iter_count(from);
+    void *data;
+    int error;
+
+    if (len > echo_queue_max_len(iocb->ki_filp))
+        return -EMSGSIZE;
+    data = kvmalloc(len, GFP_KERNEL);
+    if (data == NULL)
+        return -ENOMEM;
+    if (!copy_from_iter_full(data, len, from)) {
+        kvfree(data);
+        return -EFAULT;
+    }
+
+    while (!echo_queue_push(q, data, len)) {
+        error = -EAGAIN;
+        if (!echo_nonblock(iocb))
+            error = wait_event_interruptible(q->writers,
+                                             echo_queue_writable(q));
+        if (error) {
+            kvfree(data);
+            return error;
+        }
+    }
+
+    if (wq_has_sleeper(&q->readers))
+        wake_up_interruptible(&q->readers);
+    echo_notify_wake(echo_notify_of(iocb->ki_filp), EPOLLIN | EPOLLRDNORM);
+    return len;
+}
+
+static ssize_t
+echo_queue_read(struct echo_queue *q, struct kiocb *iocb, struct iov_iter *to)
+{
+    size_t copied;
+    void *data;
+    u32 len;
+    int error;
+
+    error = echo_queue_wait_pop(q, echo_nonblock(iocb), &data, &len,
+                                iov_iter_count(to));
+    if (error)
+        return error;
+    if (wq_has_sleeper(&q->writers))
+        wake_up_interruptible(&q->writers);
+    echo_notify_wake(echo_notify_of(iocb->ki_filp), EPOLLOUT | EPOLLWRNORM);
+
+    copied = copy_to_iter(data, len, to);
+    if (copied != len) {
+        /* a bad buffer does not cost the message */
+        iov_iter_revert(to, copied);
+        echo_queue_unpop(q, data, len);
+        wake_up_interruptible(&q->readers);
+        echo_notify_wake(echo_notify_of(iocb->ki_filp), EPOLLIN | EPOLLRDNORM);
+        return -EFAULT;
+    }
+    kvfree(data);
+    return len;
+}
+
+static ssize_t
+echo_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    echo_t *echo = iocb->ki_filp->private_data;
+    struct echo_queue *q;
+    size_t amount, copied, written = 0;
+    loff_t pos;
+
+    if (iov_iter_count(from) == 0)
+        return 0;
+    q = echo_queue_get(iocb->ki_filp);
+    if (q != NULL)
+        return echo_queue_write(q, iocb, from);
+    if (shared)
+        return echo_shared_write(iocb, from);
+
+    /*
+     * A source page that is not present ends a pass early, see
+     * echo_buf_from_iter(). It is faulted in without the lock and the
+     * write continues where the pass stopped.
+     */
+    mutex_lock(&echo->lock);
+    pos = echo_write_pos(iocb, echo->buf.length);
+    for (;;) {
+        if (pos >= echo->buffer_size) {
+            mutex_unlock(&echo->lock);
+            if (written > 0)
+                break;
+            return -ENOSPC;
+        }
+        amount = min_t(size_t, iov_iter_count(from), echo->buffer_size - pos);
+        if (echo->buf.node == NUMA_NO_NODE)
+            echo_place(echo, iocb->ki_filp->f_mapping);
+        if (echo_buf_unshare(&echo->buf, iocb->ki_filp->f_mapping,
+                             min_t(loff_t, pos, echo->buf.length),
+                             pos + amount)) {
+            mutex_unlock(&echo->lock);
+            if (written > 0)
+                break;
+            return -ENOMEM;
+        }
+        echo_map_begin(echo->header);
+        if (pos > echo->buf.length)
+            echo_buf_zero(&echo->buf, echo->buf.length, pos);
+        copied = echo_buf_from_iter(&echo->buf, pos, from, amount);
+        if (copied > 0 || amount == 0 || written > 0)
+            echo->buf.length = pos + copied;
+        echo_map_end(echo->header, echo->buf.length, echo->buffer_size);
+        mutex_unlock(&echo->lock);
+        echo_notify_wake(&echo->notify, EPOLLIN | EPOLLRDNORM);
+
+        written += copied;
+        pos += copied;
+        if (copied == amount ||
+            fault_in_iov_iter_readable(from, amount - copied) ==
+            amount - copied)
+            break;
+        mutex_lock(&echo->lock);
+    }
+
+    if (written == 0 && amount > 0)
+        return -EFAULT;
+
+    iocb->ki_pos = pos;
+    return written;
+}
+
+static ssize_t
+echo_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    echo_t *echo = iocb->ki_filp->private_data;
+    struct echo_queue *q = echo_queue_get(iocb->ki_filp);
+    size_t amount = 0, copied;
+
+    if (q != NULL)
+        return echo_queue_read(q, iocb, to);
+    if (shared)
+        return echo_shared_read(iocb, to);
+
+    mutex_lock(&echo->lock);
+    echo_notify_read(iocb->ki_filp, echo_generation(echo->header));
+    if (iocb->ki_pos < echo->buf.length)
+        amount = min_t(size_t, iov_iter_count(to),
+                       echo->buf.length - iocb->ki_pos);
+    copied = echo_buf_to_iter(&echo->buf, iocb->ki_pos, to, amount);
+    mutex_unlock(&echo->lock);
+
+    if (copied == 0 && amount > 0)
+        return -EFAULT;
+    iocb->ki_pos += copied;
+    return copied;
+}
+
+static int
+echo_set_buffer_size(echo_t *echo, struct address_space *mapping, size_t size)
+{
+    unsigned long nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+    int error;
+
+    if (echo->buffer_size == size)
+        return 0;
+
+    echo_map_begin(echo->header);
+    /* pages about to be freed must not stay mapped */
+    if (nr_pages < echo->buf.nr_pages)
+        echo_map_zap(mapping, nr_pages);
+    error = echo_buf_resize(&echo->buf, nr_pages);
+    if (error == 0) {
+        echo->buffer_size = size;
+        if (echo->buf.length > size)
+            echo->buf.length = size;
+    }
+    echo_map_end(echo->header, echo->buf.length, echo->buffer_size);
+    return error;
+}
+
+/**
+ * Switch between message and queue mode, the queue is allocated by
+ * the first switch and lives as long as the context.
+ */
+static int
+echo_set_mode(struct file *f, struct echo_mode __user *umode)
+{
+    echo_t *echo = f->private_data;
+    struct mutex *lock = shared ? &echo_shared_lock : &echo->lock;
+    struct echo_queue **qp = shared ? &echo_shared_queue : &echo->queue;
+    u32 *modep = shared ? &echo_shared_mode : &echo->mode;
+    struct echo_mode m;
+    int error = 0;
+
+    if (copy_from_user(&m, umode, sizeof(m)))
+        return -EFAULT;
+    if (m.mode > ECHO_MODE_QUEUE)
+        return -EINVAL;
+    if (m.depth && (!is_power_of_2(m.depth) || m.depth > ECHO_QUEUE_MAX_DEPTH))
+        return -EINVAL;
+
+    mutex_lock(lock);
+    if (m.mode == ECHO_MODE_QUEUE) {
+        if (*qp == NULL) {
+            struct echo_queue *q;
+
+            q = echo_queue_alloc(m.depth ? m.depth : ECHO_QUEUE_DEPTH);
+            if (q == NULL)
+                error = -ENOMEM;
+            else
+                WRITE_ONCE(*qp, q);
+        } else if (m.depth && m.depth != (*qp)->mask + 1) {
+            error = -EBUSY;
+        }
+    }
+    /* publishes the queue together with the mode */
+    if (error == 0)
+        smp_store_release(modep, m.mode);
+    mutex_unlock(lock);
+    /* readiness means something else now, let pollers look again */
+    if (error == 0)
+        echo_notify_wake(echo_notify_of(f), EPOLLIN | EPOLLOUT);
+    return error;
+}
+
+/**
+ * Take up to max_msgs messages in one call, only the first one waits.
+ * Readers and writers are woken once for the whole batch.
+ */
+static int
+echo_dequeue_batch(struct echo_queue *q, struct file *f,
+                   struct echo_batch __user *ubatch)
+{
+    struct echo_batch batch;
+    char __user *buf;
+    u32 __user *lens;
+    size_t off = 0;
+    void *data;
+    u32 len;
+    int error = 0;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    buf = u64_to_user_ptr(batch.buf);
+    lens = u64_to_user_ptr(batch.lens);
+
+    for (batch.count = 0; batch.count < batch.max_msgs; batch.count++) {
+        if (batch.count == 0)
+            error = echo_queue_wait_pop(q, f->f_flags & O_NONBLOCK, &data,
+                                        &len, batch.buf_len);
+        else
+            error = echo_queue_pop(q, &data, &len, batch.buf_len - off);
+        if (error)
+            break;
+        if (copy_to_user(buf + off, data, len) ||
+            put_user(len, lens + batch.count)) {
+            echo_queue_unpop(q, data, len);
+            wake_up_interruptible(&q->readers);
+            echo_notify_wake(echo_notify_of(f), EPOLLIN | EPOLLRDNORM);
+            error = -EFAULT;
+            break;
+        }
+        kvfree(data);
+        off += len;
+    }
+
+    if (batch.count > 0) {
+        if (wq_has_sleeper(&q->writers))
+            wake_up_interruptible(&q->writers);
+        echo_notify_wake(echo_notify_of(f), EPOLLOUT | EPOLLWRNORM);
+    }
+    /*
+     * Running out of messages or room ends a batch that got some, so
+     * does a fault: the message it hit is queued again.
+     */
+    if (batch.count == 0)
+        return error;
+    return put_user(batch.count, &ubatch->count);
+}
+
+/**
+ * Set the node of the buffer. A private buffer moves to a given node
+ * at once, for the writer's node echo_place() moves it on the next
+ * write. In shared mode the pages of later messages follow it.
+ */
+static int
+echo_set_alloc(struct file *f, struct echo_alloc __user *ualloc)
+{
+    echo_t *echo = f->private_data;
+    struct echo_alloc a;
+    int node, error = 0;
+
+    if (copy_from_user(&a, ualloc, sizeof(a)))
+        return -EFAULT;
+    if (a.node != ECHO_NODE_WRITER &&
+        (a.node < 0 || a.node >= nr_node_ids || !node_online(a.node)))
+        return -EINVAL;
+    node = a.node == ECHO_NODE_WRITER ? NUMA_NO_NODE : a.node;
+
+    if (shared) {
+        mutex_lock(&echo_shared_lock);
+        echo_shared_node = node;
+        mutex_unlock(&echo_shared_lock);
+        return 0;
+    }
+
+    mutex_lock(&echo->lock);
+    if (node == NUMA_NO_NODE)
+        echo->buf.node = node;
+    else
+        error = echo_rebuild(echo, f->f_mapping, node);
+    mutex_unlock(&echo->lock);
+    echo_notify_wake(&echo->notify, EPOLLIN | EPOLLRDNORM);
+    return error;
+}
+
+static int
+echo_get_alloc(struct file *f, struct echo_alloc __user *ualloc)
+{
+    echo_t *echo = f->private_data;
+    struct mutex *lock = shared ? &echo_shared_lock : &echo->lock;
+    struct echo_alloc a = { 0 };
+    struct echo_buf *b;
+
+    mutex_lock(lock);
+    if (shared) {
+        b = &rcu_dereference_protected(echo_shared,
+                                       lockdep_is_held(&echo_shared_lock))->buf;
+        a.node = echo_shared_node;
+    } else {
+        b = &echo->buf;
+        a.node = b->node;
+    }
+    a.data_node = b->nr_pages ? page_to_nid(b->pages[0]) : NUMA_NO_NODE;
+    mutex_unlock(lock);
+
+    return copy_to_user(ualloc, &a, sizeof(a)) ? -EFAULT : 0;
+}
+
+static long
+echo_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+    echo_t *echo = f->private_data;
+    struct echo_queue *q = echo_queue_get(f);
+    int size, error = 0;
+
+    switch (cmd) {
+    case ECHO_SET_MODE:
+        return echo_set_mode(f, (struct echo_mode __user *)arg);
+    case ECHO_SET_ALLOC:
+        return echo_set_alloc(f, (struct echo_alloc __user *)arg);
+    case ECHO_GET_ALLOC:
+        return echo_get_alloc(f, (struct echo_alloc __user *)arg);
+    case ECHO_DEQUEUE_BATCH:
+        if (q == NULL)
+            return -EINVAL;
+        return echo_dequeue_batch(q, f, (struct echo_batch __user *)arg);
+    case ECHO_CLEAR_BUFFER:
+        if (q != NULL) {
+            echo_queue_drain(q);
+            wake_up_interruptible(&q->writers);
+            echo_notify_wake(echo_notify_of(f), EPOLLOUT | EPOLLWRNORM);
+            break;
+        }
+        if (shared)
+            return echo_shared_resize(f->f_mapping, echo_shared_size, true);
+        mutex_lock(&echo->lock);
+        echo_map_begin(echo->header);
+        echo->buf.length = 0;
+        echo_map_end(echo->header, 0, echo->buffer_size);
+        mutex_unlock(&echo->lock);
+        echo_notify_wake(&echo->notify, EPOLLIN | EPOLLRDNORM);
+        break;
+    case ECHO_SET_BUFFER_SIZE:
+        if (get_user(size, (int __user *)arg))
+            return -EFAULT;
+        if (size < ECHO_MIN_SIZE || size > max_size)
+            return -EINVAL;
+        if (shared)
+            return echo_shared_resize(f->f_mapping, size, false);
+        mutex_lock(&echo->lock);
+        error = echo_set_buffer_size(echo, f->f_mapping, size);
+        mutex_unlock(&echo->lock);
+        echo_notify_wake(&echo->notify, EPOLLIN | EPOLLRDNORM);
+        break;
+    default:
+        error = -ENOTTY;
+        break;
+    }
+
+    return error;
+}
+
+/**
+ * Map the header page or a data page. The page table entry is
+ * installed here, under the lock writers hold while they replace or
+ * drop pages and zap the mappings, so a stale page cannot be mapped
+ * after its zap. The lock is only tried so that a fault never waits
+ * behind a writer: a user space access that finds it busy returns and
+ * faults again. Writers themselves copy from user memory with page
+ * faults disabled while they hold it and fault their source in after
+ * dropping it, see echo_buf_from_iter(), so a write(2) from a mapping
+ * of /dev/echo never faults in here against its own lock.
+ */
+static vm_fault_t
+echo_vm_fault(struct vm_fault *vmf)
+{
+    struct vm_area_struct *vma = vmf->vma;
+    echo_t *echo = vma->vm_file->private_data;
+    struct mutex *lock = shared ? &echo_shared_lock : &echo->lock;
+    struct echo_buf *buf;
+    struct page *page = NULL;
+    int error;
+
+    if (!mutex_trylock(lock))
+        return VM_FAULT_NOPAGE;
+
+    if (shared)
+        buf = &rcu_dereference_protected(echo_shared,
+                                         lockdep_is_held(&echo_shared_lock))->buf;
+    else
+        buf = &echo->buf;
+    if (vmf->pgoff == 0)
+        page = shared ? echo_shared_header : echo->header;
+    else if (vmf->pgoff - 1 < buf->nr_pages)
+        page = buf->pages[vmf->pgoff - 1];
+
+    error = page ? vm_insert_page(vma, vmf->address & PAGE_MASK, page) : -EFAULT;
+    mutex_unlock(lock);
+
+    switch (error) {
+    case 0:
+    case -EBUSY:            /* a concurrent fault mapped it already */
+        return VM_FAULT_NOPAGE;
+    case -ENOMEM:
+        return VM_FAULT_OOM;
+    default:
+        return VM_FAULT_SIGBUS;
+    }
+}
+
+static __poll_t
+echo_poll(struct file *f, poll_table *wait)
+{
+    struct echo_notify *n = echo_notify_of(f);
+    struct echo_queue *q;
+    __poll_t mask = 0;
+    u64 gen;
+
+    poll_wait(f, &n->wait, wait);
+    echo_notify_arm(n);
+
+    q = echo_queue_get(f);
+    if (q != NULL) {
+        if (echo_queue_readable(q))
+            mask |= EPOLLIN | EPOLLRDNORM;
+        if (echo_queue_writable(q))
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        return mask;
+    }
+
+    gen = echo_generation(shared ? echo_shared_header :
+                          ((echo_t *)f->private_data)->header);
+    if (!(gen & 1) && gen != READ_ONCE(*echo_seen_of(f)))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    return mask | EPOLLOUT | EPOLLWRNORM;
+}
+
+static int
+echo_fasync(int fd, struct file *f, int on)
+{
+    return fasync_helper(fd, f, on, &echo_notify_of(f)->fasync);
+}
+
+static const struct vm_operations_struct echo_vm_ops = {
+    .fault = echo_vm_fault,
+};
+
+/**
+ * Read-only mapping, page 0 is the header and the message follows
+ * at data_offset.
+ */
+static int
+echo_mmap(struct file *f, struct vm_area_struct *vma)
+{
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_mod(vma, VM_MIXEDMAP | VM_DONTEXPAND | VM_DONTDUMP, VM_MAYWRITE);
+#else
+    vma->vm_flags |= VM_MIXEDMAP | VM_DONTEXPAND | VM_DONTDUMP;
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+    vma->vm_ops = &echo_vm_ops;
+    return 0;
+}
+
+static void
+echo_spd_release(struct splice_pipe_desc *spd, unsigned int i)
+{
+    put_page(spd->pages[i]);
+}
+
+/* The pipe only drops its page references, the pages stay ours */
+static const struct pipe_buf_operations echo_pipe_buf_ops = {
+    .release = generic_pipe_buf_release,
+    .get     = generic_pipe_buf_get,
+};
+
+/* Add references to the pages of [pos, pos + len) of b to spd */
+static void
+echo_buf_fill_spd(struct echo_buf *b, loff_t pos, size_t len,
+                  struct splice_pipe_desc *spd)
+{
+    while (len > 0 && spd->nr_pages < spd->nr_pages_max) {
+        size_t off = offset_in_page(pos);
+        size_t n = min_t(size_t, len, PAGE_SIZE - off);
+        struct page *page = b->pages[pos >> PAGE_SHIFT];
+
+        get_page(page);
+        spd->pages[spd->nr_pages] = page;
+        spd->partial[spd->nr_pages].offset = off;
+        spd->partial[spd->nr_pages].len = n;
+        spd->nr_pages++;
+        pos += n;
+        len -= n;
+    }
+}
+
+/**
+ * Splice the message into a pipe without copying it, up to
+ * PIPE_DEF_BUFFERS pages per call. Queue mode has message boundaries
+ * to keep and goes through read_iter.
+ */
+static ssize_t
+echo_splice_read(struct file *f, loff_t *ppos, struct pipe_inode_info *pipe,
+                 size_t len, unsigned int flags)
+{
+    struct page *pages[PIPE_DEF_BUFFERS];
+    struct partial_page partial[PIPE_DEF_BUFFERS];
+    struct splice_pipe_desc spd = {
+        .pages        = pages,
+        .partial      = partial,
+        .nr_pages_max = PIPE_DEF_BUFFERS,
+        .ops          = &echo_pipe_buf_ops,
+        .spd_release  = echo_spd_release,
+    };
+    echo_t *echo = f->private_data;
+    struct echo_buf *buf;
+    ssize_t ret;
+    int idx;
+
+    if (echo_queue_get(f) != NULL)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+        return copy_splice_read(f, ppos, pipe, len, flags);
+#else
+        return generic_file_splice_read(f, ppos, pipe, len, flags);
+#endif
+
+    if (shared) {
+        echo_notify_read(f, echo_generation(echo_shared_header) & ~1ULL);
+        idx = srcu_read_lock(&echo_srcu);
+        buf = &srcu_dereference(echo_shared, &echo_srcu)->buf;
+        if (*ppos < buf->length)
+            echo_buf_fill_spd(buf, *ppos, min_t(size_t, len, buf->length - *ppos),
+                              &spd);
+        srcu_read_unlock(&echo_srcu, idx);
+    } else {
+        mutex_lock(&echo->lock);
+        echo_notify_read(f, echo_generation(echo->header));
+        buf = &echo->buf;
+        if (*ppos < buf->length)
+            echo_buf_fill_spd(buf, *ppos, min_t(size_t, len, buf->length - *ppos),
+                              &spd);
+        mutex_unlock(&echo->lock);
+    }
+
+    if (spd.nr_pages == 0)
+        return 0;
+    ret = splice_to_pipe(pipe, &spd);
+    if (ret > 0)
+        *ppos += ret;
+    return ret;
+}
+
+static int
+echo_numa_show(struct seq_file *sf, void *unused)
+{
+    int node;
+
+    seq_puts(sf, "node        pages       remote\n");
+    for_each_node(node)
+        seq_printf(sf, "%4d %12ld %12ld\n", node,
+                   atomic_long_read(&echo_stats[node].pages),
+                   atomic_long_read(&echo_stats[node].remote));
+    return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(echo_numa);
+
+static struct file_operations echo_fops = {
+    .owner          = THIS_MODULE,
+    .open           = echo_open,
+    .release        = echo_release,
+    .read_iter      = echo_read_iter,
+    .write_iter     = echo_write_iter,
+    .llseek         = default_llseek,
+    .unlocked_ioctl = echo_ioctl,
+    .compat_ioctl   = compat_ptr_ioctl,
+    .mmap           = echo_mmap,
+    .poll           = echo_poll,
+    .fasync         = echo_fasync,
+    .splice_read    = echo_splice_read,
+};
+
+/**
+ * Initialize kernel module
+ */
+static int __init
+echo_init(void)
+{
+    int error = -ENOMEM;
+
+    if (max_size < ECHO_MIN_SIZE || max_size > INT_MAX)
+        return -EINVAL;
+
+    echo_cache = kmem_cache_create("echo_ctx", sizeof(echo_t), 0,
+                                   SLAB_HWCACHE_ALIGN, NULL);
+    if (echo_cache == NULL)
+        return -ENOMEM;
+
+    echo_stats = kcalloc(nr_node_ids, sizeof(*echo_stats), GFP_KERNEL);
+    if (echo_stats == NULL)
+        goto out_cache;
+
+    echo_wq = alloc_workqueue("echo", 0, 0);
+    if (echo_wq == NULL)
+        goto out_stats;
+
+    echo_notify_init(&echo_shared_notify);
+    echo_shared_header = echo_header_alloc();
+    if (echo_shared_header == NULL)
+        goto out_wq;
+
+    RCU_INIT_POINTER(echo_shared, echo_msg_alloc(0));
+    if (rcu_access_pointer(echo_shared) == NULL)
+        goto out_header;
+
+    error = alloc_chrdev_region(&echo_num, 0, 1, "echo");
+    if (error < 0)
+        goto out_message;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    echo_class = class_create("echo");
+#else
+    echo_class = class_create(THIS_MODULE, "echo");
+#endif
+    if (IS_ERR(echo_class)) {
+        error = PTR_ERR(echo_class);
+        goto out_region;
+    }
+
+    cdev_init(&echo_cdev, &echo_fops);
+    error = cdev_add(&echo_cdev, echo_num, 1);
+    if (error < 0)
+        goto out_class;
+
+    if (IS_ERR(device_create(echo_class, NULL, echo_num, NULL, "echo"))) {
+        error = -ENODEV;
+        goto out_cdev;
+    }
+
+    echo_debug_dir = debugfs_create_dir("echo", NULL);
+    debugfs_create_file("numa", 0400, echo_debug_dir, NULL, &echo_numa_fops);
+
+    printk(KERN_INFO "Echo driver loaded.\n");
+    return 0;
+
+out_cdev:
+    cdev_del(&echo_cdev);
+out_class:
+    class_destroy(echo_class);
+out_region:
+    unregister_chrdev_region(echo_num, 1);
+out_message:
+    echo_msg_free(rcu_access_pointer(echo_shared));
+out_header:
+    put_page(echo_shared_header);
+out_wq:
+    destroy_workqueue(echo_wq);
+out_stats:
+    kfree(echo_stats);
+out_cache:
+    kmem_cache_destroy(echo_cache);
+    return error;
+}
+
+/**
+ * Cleanup kernel module
+ */
+static void __exit
+echo_exit(void)
+{
+    debugfs_remove_recursive(echo_debug_dir);
+    device_destroy(echo_class, echo_num);
+    cdev_del(&echo_cdev);
+    class_destroy(echo_class);
+    unregister_chrdev_region(echo_num, 1);
+    srcu_barrier(&echo_srcu);
+    destroy_workqueue(echo_wq);
+    echo_msg_free(rcu_access_pointer(echo_shared));
+    echo_queue_free(echo_shared_queue);
+    put_page(echo_shared_header);
+    kfree(echo_stats);
+    kmem_cache_destroy(echo_cache);
+    printk(KERN_INFO "Echo driver unloaded.\n");
+}
+
+module_init(echo_init);
+module_exit(echo_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Echo driver");
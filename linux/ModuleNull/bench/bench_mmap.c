@@ -0,0 +1,103 @@
+/*
+ * Compare fault rate and RSS of a private /dev/mynull mapping against
+ * an anonymous mapping of the same size.
+ *
+ *   ./bench_mmap [size_mb] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+static long page_size;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long minflt(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+static long rss_kb(void)
+{
+    long size, resident;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f == NULL)
+        return -1;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+        resident = -1;
+    fclose(f);
+    return resident * (page_size / 1024);
+}
+
+static void touch(const char *name, const char *phase, char *p, size_t len, int write)
+{
+    volatile char sink = 0;
+    long flt = minflt(), rss = rss_kb();
+    double t = now();
+    size_t off;
+
+    for (off = 0; off < len; off += page_size) {
+        if (write)
+            p[off] = 1;
+        else
+            sink += p[off];
+    }
+
+    t = now() - t;
+    flt = minflt() - flt;
+    printf("%-8s %-6s %10ld %12.0f %12ld\n", name, phase, flt,
+           flt / t, rss_kb() - rss);
+    (void)sink;
+}
+
+static void run(const char *name, int fd, size_t len)
+{
+    int flags = MAP_PRIVATE | (fd < 0 ? MAP_ANONYMOUS : 0);
+    char *p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, fd, 0);
+
+    if (p == MAP_FAILED) {
+        perror(name);
+        exit(1);
+    }
+    touch(name, "read", p, len, 0);
+    touch(name, "write", p, len, 1);
+    munmap(p, len);
+}
+
+int main(int argc, char **argv)
+{
+    size_t len = (size_t)(argc > 1 ? atol(argv[1]) : 1024) << 20;
+    const char *dev = argc > 2 ? argv[2] : "/dev/mynull0";
+    int fd;
+
+    page_size = sysconf(_SC_PAGESIZE);
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        perror(dev);
+        return 1;
+    }
+
+    printf("%-8s %-6s %10s %12s %12s\n", "map", "phase", "faults",
+           "faults/s", "rss_kb");
+    run("anon", -1, len);
+    run("mynull", fd, len);
+
+    close(fd);
+    return 0;
+}
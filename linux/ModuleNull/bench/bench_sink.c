@@ -0,0 +1,197 @@
+/*
+ * Write throughput of every MYNULL_SET_SINK mode, the digest returned by
+ * MYNULL_GET_DIGEST is checked against a user space computation.
+ *
+ *   ./bench_sink [total_mb] [bs_kb] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "mynull_ioctl.h"
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t crc32c_table[256];
+
+static void crc32c_init(void)
+{
+    uint32_t i, j, c;
+
+    for (i = 0; i < 256; i++) {
+        for (c = i, j = 0; j < 8; j++)
+            c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        crc32c_table[i] = c;
+    }
+}
+
+static uint32_t crc32c(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len--)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#define P1 0x9E3779B185EBCA87ULL
+#define P2 0xC2B2AE3D27D4EB4FULL
+#define P3 0x165667B19E3779F9ULL
+#define P4 0x85EBCA77C2B2AE63ULL
+#define P5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t rd64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t in)
+{
+    return rotl(acc + in * P2, 31) * P1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t v)
+{
+    return (acc ^ xxh_round(0, v)) * P1 + P4;
+}
+
+/* One-shot xxHash64, the benchmark buffer is hashed as a whole */
+static uint64_t xxh64(const uint8_t *p, size_t len, uint64_t seed)
+{
+    const uint8_t *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+
+        do {
+            v1 = xxh_round(v1, rd64(p));
+            v2 = xxh_round(v2, rd64(p + 8));
+            v3 = xxh_round(v3, rd64(p + 16));
+            v4 = xxh_round(v4, rd64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += len;
+
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ xxh_round(0, rd64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) {
+        h = rotl(h ^ (rd32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl(h ^ (*p * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *names[] = { "none", "crc32c", "xxh64" };
+    size_t total = (size_t)(argc > 1 ? atol(argv[1]) : 1024) << 20;
+    size_t bs = (size_t)(argc > 2 ? atol(argv[2]) : 1024) << 10;
+    const char *dev = argc > 3 ? argv[3] : "/dev/mynull0";
+    struct mynull_sink sink;
+    struct mynull_digest d;
+    uint64_t want = 0;
+    unsigned int mode;
+    uint8_t *buf;
+    size_t i;
+    int fd;
+
+    if (total % bs)
+        total -= total % bs;
+
+    fd = open(dev, O_WRONLY);
+    if (fd < 0) {
+        perror(dev);
+        return 1;
+    }
+    buf = malloc(total);
+    if (buf == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < total; i++)
+        buf[i] = rand();
+    crc32c_init();
+
+    printf("%-8s %10s %18s %8s\n", "mode", "MB/s", "digest", "check");
+    for (mode = MYNULL_SINK_NONE; mode <= MYNULL_SINK_XXH64; mode++) {
+        size_t done;
+        double t;
+
+        memset(&sink, 0, sizeof(sink));
+        sink.mode = mode;
+        sink.seed = 42;
+        if (ioctl(fd, MYNULL_SET_SINK, &sink) < 0) {
+            perror("MYNULL_SET_SINK");
+            return 1;
+        }
+
+        t = now();
+        for (done = 0; done < total; done += bs) {
+            if (write(fd, buf + done, bs) != (ssize_t)bs) {
+                perror("write");
+                return 1;
+            }
+        }
+        t = now() - t;
+
+        if (ioctl(fd, MYNULL_GET_DIGEST, &d) < 0) {
+            perror("MYNULL_GET_DIGEST");
+            return 1;
+        }
+        if (mode == MYNULL_SINK_CRC32C)
+            want = ~crc32c(~0U, buf, total);
+        else if (mode == MYNULL_SINK_XXH64)
+            want = xxh64(buf, total, sink.seed);
+
+        printf("%-8s %10.0f %18llx %8s\n", names[mode], total / t / 1e6,
+               (unsigned long long)d.digest,
+               d.digest == want && d.bytes == (mode ? total : 0) ? "ok" : "FAIL");
+    }
+
+    free(buf);
+    close(fd);
+    return 0;
+}
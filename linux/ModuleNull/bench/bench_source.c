@@ -0,0 +1,118 @@
+/*
+ * Read bandwidth of every MYNULL_SET_SOURCE mode, optionally checking
+ * that the stream matches its definition in mynull_ioctl.h.
+ *
+ *   ./bench_source [total_mb] [bs_kb] [verify] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "mynull_ioctl.h"
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t expected(const struct mynull_source *src, uint64_t off)
+{
+    uint64_t w;
+
+    switch (src->mode) {
+    case MYNULL_SRC_PATTERN:
+        return src->pattern[off % src->pattern_len];
+    case MYNULL_SRC_COUNTER:
+        w = src->seed + (off >> 3);
+        break;
+    case MYNULL_SRC_PRNG:
+        w = mynull_splitmix64(src->seed, off >> 3);
+        break;
+    default:
+        return 0;
+    }
+    return w >> ((off & 7) * 8);
+}
+
+static long check(const struct mynull_source *src, const uint8_t *buf,
+                  size_t len, uint64_t off)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        if (buf[i] != expected(src, off + i))
+            return (long)(off + i);
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *names[] = { "eof", "zero", "pattern", "counter", "prng" };
+    size_t total = (size_t)(argc > 1 ? atol(argv[1]) : 4096) << 20;
+    size_t bs = (size_t)(argc > 2 ? atol(argv[2]) : 1024) << 10;
+    int verify = argc > 3 ? atoi(argv[3]) : 0;
+    const char *dev = argc > 4 ? argv[4] : "/dev/mynull0";
+    struct mynull_source src;
+    unsigned int mode;
+    uint8_t *buf;
+    int fd;
+
+    fd = open(dev, O_RDONLY);
+    if (fd < 0) {
+        perror(dev);
+        return 1;
+    }
+    buf = aligned_alloc(4096, bs);
+    if (buf == NULL) {
+        perror("aligned_alloc");
+        return 1;
+    }
+
+    printf("%-8s %10s %8s\n", "mode", "MB/s", "verify");
+    for (mode = MYNULL_SRC_ZERO; mode <= MYNULL_SRC_PRNG; mode++) {
+        size_t done = 0;
+        long bad = -1;
+        double t;
+
+        memset(&src, 0, sizeof(src));
+        src.mode = mode;
+        src.seed = 0x1234abcd;
+        src.pattern_len = 13;
+        memcpy(src.pattern, "mynull-stream", 13);
+        if (ioctl(fd, MYNULL_SET_SOURCE, &src) < 0) {
+            perror("MYNULL_SET_SOURCE");
+            return 1;
+        }
+
+        t = now();
+        while (done < total) {
+            ssize_t n = pread(fd, buf, bs, done);
+
+            if (n <= 0) {
+                perror("pread");
+                return 1;
+            }
+            if (verify && bad < 0)
+                bad = check(&src, buf, n, done);
+            done += n;
+        }
+        t = now() - t;
+
+        printf("%-8s %10.0f %8s\n", names[mode], total / t / 1e6,
+               !verify ? "-" : bad < 0 ? "ok" : "FAIL");
+        if (bad >= 0)
+            fprintf(stderr, "%s: mismatch at offset %ld\n", names[mode], bad);
+    }
+
+    free(buf);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Drain a page-cache resident file into the null device with
+ * read+write(2), splice(2) through a pipe and sendfile(2), for buffer
+ * sizes from 4 KiB to 1 MiB.
+ *
+ *   ./bench_splice [file_mb] [device]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/sendfile.h>
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void drain_write(int src, int dev, size_t len, size_t bs, char *buf)
+{
+    off_t off = 0;
+
+    while ((size_t)off < len) {
+        ssize_t n = pread(src, buf, bs, off);
+
+        if (n <= 0)
+            die("pread");
+        if (write(dev, buf, n) != n)
+            die("write");
+        off += n;
+    }
+}
+
+static void drain_splice(int src, int dev, size_t len, size_t bs, int pfd[2])
+{
+    loff_t off = 0;
+
+    while ((size_t)off < len) {
+        ssize_t n = splice(src, &off, pfd[1], NULL, bs, SPLICE_F_MOVE);
+        ssize_t m;
+
+        if (n <= 0)
+            die("splice in");
+        while (n > 0) {
+            m = splice(pfd[0], NULL, dev, NULL, n, SPLICE_F_MOVE);
+            if (m <= 0)
+                die("splice out");
+            n -= m;
+        }
+    }
+}
+
+static void drain_sendfile(int src, int dev, size_t len, size_t bs)
+{
+    off_t off = 0;
+
+    while ((size_t)off < len) {
+        if (sendfile(dev, src, &off, bs) <= 0)
+            die("sendfile");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t len = (size_t)(argc > 1 ? atol(argv[1]) : 256) << 20;
+    const char *dev_path = argc > 2 ? argv[2] : "/dev/mynull0";
+    char path[] = "/tmp/bench_splice.XXXXXX";
+    size_t bs, off;
+    int src, dev, pfd[2];
+    char *buf;
+
+    src = mkstemp(path);
+    if (src < 0)
+        die("mkstemp");
+    unlink(path);
+
+    buf = malloc(1 << 20);
+    if (buf == NULL)
+        die("malloc");
+    memset(buf, 0xa5, 1 << 20);
+    for (off = 0; off < len; off += 1 << 20)
+        if (write(src, buf, 1 << 20) != 1 << 20)
+            die("fill");
+
+    dev = open(dev_path, O_WRONLY);
+    if (dev < 0)
+        die(dev_path);
+    if (pipe(pfd) < 0)
+        die("pipe");
+
+    /* warm the page cache */
+    drain_write(src, dev, len, 1 << 20, buf);
+
+    printf("%8s %12s %12s %12s\n", "bs", "write_MBs", "splice_MBs",
+           "sendfile_MBs");
+    for (bs = 4096; bs <= 1 << 20; bs <<= 1) {
+        double t0, t1, t2, t3;
+
+        fcntl(pfd[1], F_SETPIPE_SZ, bs < 65536 ? 65536 : bs);
+
+        t0 = now();
+        drain_write(src, dev, len, bs, buf);
+        t1 = now();
+        drain_splice(src, dev, len, bs, pfd);
+        t2 = now();
+        drain_sendfile(src, dev, len, bs);
+        t3 = now();
+
+        printf("%8zu %12.0f %12.0f %12.0f\n", bs,
+               len / (t1 - t0) / 1e6, len / (t2 - t1) / 1e6,
+               len / (t3 - t2) / 1e6);
+    }
+
+    free(buf);
+    close(pfd[0]);
+    close(pfd[1]);
+    close(dev);
+    close(src);
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * io_uring write throughput into the null device at queue depths
+ * 1 to 256, using the raw io_uring syscalls.
+ *
+ *   ./bench_uring [ops_per_depth] [bs] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct ring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_len, cq_len, sqes_len;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void ring_init(struct ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    size_t sq_len, cq_len;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        die("io_uring_setup");
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP && cq_len > sq_len)
+        sq_len = cq_len;
+
+    sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              r->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        die("mmap sq");
+    cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            die("mmap cq");
+    }
+    r->sq_ring = sq;
+    r->cq_ring = cq;
+    r->sq_len = sq_len;
+    r->cq_len = cq_len;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        die("mmap sqes");
+
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+static void ring_exit(struct ring *r)
+{
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_len);
+    munmap(r->sq_ring, r->sq_len);
+    close(r->fd);
+}
+
+static void queue_write(struct ring *r, int fd, void *buf, unsigned len)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = -1;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static unsigned reap(struct ring *r)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+
+    for (; head != tail; head++, n++) {
+        if (r->cqes[head & *r->cq_mask].res < 0) {
+            fprintf(stderr, "write: %s\n",
+                    strerror(-r->cqes[head & *r->cq_mask].res));
+            exit(1);
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    long total = argc > 1 ? atol(argv[1]) : 1000000;
+    unsigned bs = argc > 2 ? atoi(argv[2]) : 4096;
+    const char *dev = argc > 3 ? argv[3] : "/dev/mynull0";
+    unsigned qd;
+    char *buf;
+    int fd;
+
+    fd = open(dev, O_WRONLY);
+    if (fd < 0)
+        die(dev);
+    buf = calloc(1, bs);
+    if (buf == NULL)
+        die("calloc");
+
+    printf("%6s %14s\n", "qd", "ops/s");
+    for (qd = 1; qd <= 256; qd <<= 1) {
+        struct ring r;
+        long done = 0, inflight = 0;
+        double t;
+
+        ring_init(&r, qd);
+        t = now();
+        while (done < total) {
+            unsigned submit = 0;
+
+            while (inflight + submit < qd && done + inflight + submit < total) {
+                queue_write(&r, fd, buf, bs);
+                submit++;
+            }
+            if (syscall(__NR_io_uring_enter, r.fd, submit, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+                die("io_uring_enter");
+            inflight += submit;
+            submit = reap(&r);
+            inflight -= submit;
+            done += submit;
+        }
+        t = now() - t;
+        printf("%6u %14.0f\n", qd, total / t);
+        ring_exit(&r);
+    }
+
+    free(buf);
+    close(fd);
+    return 0;
+}
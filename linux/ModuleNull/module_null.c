@@ -7,6 +7,30 @@
 #include <linux/fs.h>
 #include <linux/device.h>
 #include <linux/cdev.h>
+#include <linux/debugfs.h>
+#include <linux/jump_label.h>
+#include <linux/mm.h>
+#include <linux/splice.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/math64.h>
+#include <linux/topology.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/sizes.h>
+#include <linux/uaccess.h>
+#include <linux/sched/signal.h>
+#include <linux/highmem.h>
+#include <linux/crc32c.h>
+#include <linux/xxhash.h>
+
+#include "fop_stats.h"
+#include "mynull_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "module_null_trace.h"
 
 /**
  * Device number
@@ -14,79 +38,670 @@
 static dev_t device_num;
 
 /**
- * Device structure
+ * Number of minors, /dev/mynull0 .. /dev/mynull<nr_minors - 1>
+ */
+static unsigned int nr_minors = 1;
+module_param(nr_minors, uint, S_IRUGO);
+MODULE_PARM_DESC(nr_minors, "Number of /dev/mynullN instances");
+
+/**
+ * Steer every open to the instance of the opener's CPU. The CPUs are
+ * split into nr_minors contiguous ranges, one per minor, see
+ * cpu_to_minor().
+ */
+static bool percpu_open;
+module_param(percpu_open, bool, S_IRUGO);
+MODULE_PARM_DESC(percpu_open, "Redirect open() to the local CPU's instance");
+
+/**
+ * Per-minor device state, one cache line aligned allocation on the
+ * NUMA node of the first CPU steered to the minor. bytes_written is
+ * bumped by every write and kept per CPU, opens only by open().
+ */
+struct mynull_dev {
+    struct cdev cdev;
+    unsigned int minor;
+    int node;
+    atomic_long_t opens;
+    unsigned long __percpu *bytes_written;
+} ____cacheline_aligned_in_smp;
+
+static struct mynull_dev **devs;
+
+/**
+ * CPU c goes to minor c * nr_minors / nr_cpu_ids, so each minor gets a
+ * contiguous range of CPUs. CPUs are numbered node by node on most
+ * machines, so a range stays on one node when nr_minors is a multiple
+ * of the number of nodes.
+ */
+static unsigned int cpu_to_minor(unsigned int cpu)
+{
+    return div_u64((u64)cpu * nr_minors, nr_cpu_ids);
+}
+
+/* The first CPU steered to minor n, the node of its state */
+static unsigned int minor_to_cpu(unsigned int n)
+{
+    return min_t(u64, DIV_ROUND_UP_ULL((u64)n * nr_cpu_ids, nr_minors),
+                 nr_cpu_ids - 1);
+}
+
+/**
+ * Generated data is produced in chunks of this size and copied out,
+ * small enough to stay in L1/L2 between generation and copy.
+ */
+#define SOURCE_CHUNK    SZ_16K
+#define SOURCE_STEP     (SOURCE_CHUNK - MYNULL_PATTERN_MAX)
+
+/**
+ * Per-open file state
  */
-static struct cdev c_dev;
+struct mynull_file {
+    struct mynull_dev *dev;
+    struct mutex lock;          /* protects src and chunk */
+    struct mynull_source src;
+    __le64 *chunk;              /* SOURCE_CHUNK bytes, allocated on demand */
+
+    struct mutex sink_lock;     /* protects the sink fields below */
+    u32 sink_mode;
+    u32 crc;
+    struct xxh64_state xxh;
+    u64 sink_bytes;
+    u8 *sink_chunk;             /* SOURCE_CHUNK bytes bounce buffer */
+};
 
 /**
  * Device class
  */
 static struct class *cl;
 
+/**
+ * debugfs directory, /sys/kernel/debug/mynull
+ */
+static struct dentry *debug_dir;
+
+/**
+ * Per-call logging is off by default, enable it with
+ * echo 1 > /sys/kernel/debug/mynull/log
+ */
+static DEFINE_STATIC_KEY_FALSE(log_key);
+
+/**
+ * Per-CPU latency statistics, /sys/kernel/debug/mynull/stats
+ */
+enum {
+    MYNULL_OP_OPEN,
+    MYNULL_OP_CLOSE,
+    MYNULL_OP_READ,
+    MYNULL_OP_WRITE,
+    MYNULL_OP_SPLICE,
+    MYNULL_NR_OPS
+};
+
+static const char * const op_names[MYNULL_NR_OPS] = {
+    [MYNULL_OP_OPEN]   = "open",
+    [MYNULL_OP_CLOSE]  = "close",
+    [MYNULL_OP_READ]   = "read",
+    [MYNULL_OP_WRITE]  = "write",
+    [MYNULL_OP_SPLICE] = "splice",
+};
+
+static struct fop_stats stats;
+
+#define mynull_log(fmt, ...)                                    \
+    do {                                                        \
+        if (static_branch_unlikely(&log_key))                   \
+            printk(KERN_INFO "Module: " fmt, ##__VA_ARGS__);    \
+    } while (0)
+
 static int open_device(struct inode *i, struct file *f)
 {
-    printk(KERN_INFO "Module: open()\n");
+    u64 t = fop_stats_start();
+    struct mynull_dev *dev = container_of(i->i_cdev, struct mynull_dev, cdev);
+    struct mynull_file *mf;
+
+    if (percpu_open)
+        dev = devs[cpu_to_minor(raw_smp_processor_id())];
+
+    mf = kzalloc_node(sizeof(*mf), GFP_KERNEL, dev->node);
+    if (mf == NULL)
+        return -ENOMEM;
+    mf->dev = dev;
+    mutex_init(&mf->lock);
+    mutex_init(&mf->sink_lock);
+    f->private_data = mf;
+    atomic_long_inc(&dev->opens);
+
+    trace_mynull_open(0, f->f_pos);
+    mynull_log("open()\n");
+
+    /* Nothing here ever blocks, let io_uring and RWF_NOWAIT complete inline */
+    f->f_mode |= FMODE_NOWAIT;
+
+    fop_stats_end(&stats, MYNULL_OP_OPEN, 0, t);
     return 0;
 }
 
 static int close_device(struct inode *i, struct file *f)
 {
-    printk(KERN_INFO "Module: close()\n");
+    u64 t = fop_stats_start();
+    struct mynull_file *mf = f->private_data;
+
+    trace_mynull_close(0, f->f_pos);
+    mynull_log("close()\n");
+    kfree(mf->chunk);
+    kfree(mf->sink_chunk);
+    kfree(mf);
+    fop_stats_end(&stats, MYNULL_OP_CLOSE, 0, t);
     return 0;
 }
 
-static ssize_t read_device(struct file *f, char __user *buf, size_t len, loff_t *off)
+/**
+ * Generate the stream bytes [pos, pos + SOURCE_STEP) into the chunk and
+ * return the offset of pos inside it. Words are produced with plain
+ * 64-bit stores, the copy out is the only pass over user memory.
+ */
+static size_t source_fill(struct mynull_file *mf, u64 pos)
 {
-    printk(KERN_INFO "Module: read()\n");
+    const struct mynull_source *src = &mf->src;
+    u64 w = pos >> 3;
+    unsigned int i;
+
+    switch (src->mode) {
+    case MYNULL_SRC_PATTERN:
+        /* chunk holds the repeated pattern since MYNULL_SET_SOURCE */
+        return do_div(pos, src->pattern_len);
+    case MYNULL_SRC_COUNTER:
+        for (i = 0; i < SOURCE_CHUNK / 8; i++)
+            mf->chunk[i] = cpu_to_le64(src->seed + w + i);
+        break;
+    case MYNULL_SRC_PRNG:
+        for (i = 0; i < SOURCE_CHUNK / 8; i++)
+            mf->chunk[i] = cpu_to_le64(mynull_splitmix64(src->seed, w + i));
+        break;
+    }
+    return pos & 7;
+}
+
+static ssize_t read_source(struct mynull_file *mf, struct kiocb *iocb,
+                           struct iov_iter *to)
+{
+    size_t count = iov_iter_count(to);
+    size_t step, off, copied, total = 0;
+
+    if (READ_ONCE(mf->src.mode) == MYNULL_SRC_ZERO) {
+        total = iov_iter_zero(count, to);
+        goto out;
+    }
+
+    if (iocb->ki_flags & IOCB_NOWAIT) {
+        if (!mutex_trylock(&mf->lock))
+            return -EAGAIN;
+    } else {
+        mutex_lock(&mf->lock);
+    }
+
+    /* raced with MYNULL_SET_SOURCE switching away from a generated mode */
+    if (mf->src.mode < MYNULL_SRC_PATTERN) {
+        mutex_unlock(&mf->lock);
+        return 0;
+    }
+
+    while (iov_iter_count(to) > 0) {
+        step = min_t(size_t, iov_iter_count(to), SOURCE_STEP);
+        off = source_fill(mf, iocb->ki_pos + total);
+        copied = copy_to_iter((u8 *)mf->chunk + off, step, to);
+        total += copied;
+        if (copied < step || signal_pending(current))
+            break;
+        cond_resched();
+    }
+
+    mutex_unlock(&mf->lock);
+out:
+    if (total == 0 && count > 0)
+        return -EFAULT;
+    iocb->ki_pos += total;
+    return total;
+}
+
+/**
+ * read(2), readv(2) and io_uring reads all end here, they see EOF unless
+ * a source mode was selected with MYNULL_SET_SOURCE.
+ */
+static ssize_t read_device(struct kiocb *iocb, struct iov_iter *to)
+{
+    u64 t = fop_stats_start();
+    struct mynull_file *mf = iocb->ki_filp->private_data;
+    ssize_t ret = 0;
+
+    trace_mynull_read(iov_iter_count(to), iocb->ki_pos);
+    mynull_log("read()\n");
+    if (READ_ONCE(mf->src.mode) != MYNULL_SRC_EOF)
+        ret = read_source(mf, iocb, to);
+    fop_stats_end(&stats, MYNULL_OP_READ, ret > 0 ? ret : 0, t);
+    return ret;
+}
+
+/**
+ * Fold data into the running digest, called with sink_lock held.
+ */
+static void sink_update(struct mynull_file *mf, const void *data, size_t len)
+{
+    if (mf->sink_mode == MYNULL_SINK_CRC32C)
+        mf->crc = crc32c(mf->crc, data, len);
+    else
+        xxh64_update(&mf->xxh, data, len);
+    mf->sink_bytes += len;
+}
+
+static int sink_lock(struct mynull_file *mf, bool nowait)
+{
+    if (!nowait) {
+        mutex_lock(&mf->sink_lock);
+        return 0;
+    }
+    return mutex_trylock(&mf->sink_lock) ? 0 : -EAGAIN;
+}
+
+/**
+ * User data can only be hashed after it is copied in, it goes through
+ * a small bounce chunk that stays in cache for the checksum pass.
+ */
+static ssize_t write_sink(struct mynull_file *mf, struct kiocb *iocb,
+                          struct iov_iter *from)
+{
+    size_t count = iov_iter_count(from);
+    size_t step, copied, total = 0;
+    int ret;
+
+    ret = sink_lock(mf, iocb->ki_flags & IOCB_NOWAIT);
+    if (ret < 0)
+        return ret;
+
+    if (mf->sink_mode == MYNULL_SINK_NONE) {
+        iov_iter_advance(from, count);
+        total = count;
+        goto out;
+    }
+
+    while (iov_iter_count(from) > 0) {
+        step = min_t(size_t, iov_iter_count(from), SOURCE_CHUNK);
+        copied = copy_from_iter(mf->sink_chunk, step, from);
+        sink_update(mf, mf->sink_chunk, copied);
+        total += copied;
+        if (copied < step || signal_pending(current))
+            break;
+        cond_resched();
+    }
+
+out:
+    mutex_unlock(&mf->sink_lock);
+    if (total == 0 && count > 0)
+        return -EFAULT;
+    return total;
+}
+
+/**
+ * Without a sink the whole iov_iter is consumed at once, a writev(2) of
+ * any number of segments costs the same as a single write(2) and
+ * nothing is copied. In sink mode every byte is copied in and hashed.
+ */
+static ssize_t write_device(struct kiocb *iocb, struct iov_iter *from)
+{
+    u64 t = fop_stats_start();
+    size_t len = iov_iter_count(from);
+    struct mynull_file *mf = iocb->ki_filp->private_data;
+    struct mynull_dev *dev = mf->dev;
+    ssize_t ret = len;
+
+    trace_mynull_write(len, iocb->ki_pos);
+    mynull_log("write()\n");
+    if (READ_ONCE(mf->sink_mode) != MYNULL_SINK_NONE)
+        ret = write_sink(mf, iocb, from);
+    else
+        iov_iter_advance(from, len);
+    if (ret > 0)
+        this_cpu_add(*dev->bytes_written, ret);
+    fop_stats_end(&stats, MYNULL_OP_WRITE, ret > 0 ? ret : 0, t);
+    return ret;
+}
+
+static int pipe_to_null(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
+                        struct splice_desc *sd)
+{
+    return sd->len;
+}
+
+/**
+ * Pipe pages are hashed in place, spliced data is never copied.
+ */
+static int pipe_to_sink(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
+                        struct splice_desc *sd)
+{
+    struct mynull_file *mf = sd->u.file->private_data;
+    void *p = kmap_local_page(buf->page);
+
+    sink_update(mf, p + buf->offset, sd->len);
+    kunmap_local(p);
+    return sd->len;
+}
+
+/**
+ * splice(2) and sendfile(2) sink. Without a sink mode pipe buffers are
+ * released without their pages ever being mapped or copied, in sink
+ * mode every page is mapped and hashed in place.
+ */
+static ssize_t splice_write_device(struct pipe_inode_info *pipe, struct file *f,
+                                   loff_t *off, size_t len, unsigned int flags)
+{
+    u64 t = fop_stats_start();
+    struct mynull_file *mf = f->private_data;
+    struct mynull_dev *dev = mf->dev;
+    ssize_t ret;
+
+    trace_mynull_splice(len, *off);
+    mynull_log("splice_write()\n");
+    if (READ_ONCE(mf->sink_mode) != MYNULL_SINK_NONE) {
+        ret = sink_lock(mf, flags & SPLICE_F_NONBLOCK);
+        if (ret < 0)
+            goto out;
+        ret = splice_from_pipe(pipe, f, off, len, flags,
+                               mf->sink_mode == MYNULL_SINK_NONE ?
+                               pipe_to_null : pipe_to_sink);
+        mutex_unlock(&mf->sink_lock);
+    } else {
+        ret = splice_from_pipe(pipe, f, off, len, flags, pipe_to_null);
+    }
+out:
+    if (ret > 0)
+        this_cpu_add(*dev->bytes_written, ret);
+    fop_stats_end(&stats, MYNULL_OP_SPLICE, ret > 0 ? ret : 0, t);
+    return ret;
+}
+
+static long set_source(struct mynull_file *mf, const struct mynull_source *src)
+{
+    u8 *p;
+    unsigned int i;
+
+    if (src->mode > MYNULL_SRC_PRNG)
+        return -EINVAL;
+    if (src->mode == MYNULL_SRC_PATTERN &&
+        (src->pattern_len == 0 || src->pattern_len > MYNULL_PATTERN_MAX))
+        return -EINVAL;
+
+    mutex_lock(&mf->lock);
+    if (mf->chunk == NULL && src->mode >= MYNULL_SRC_PATTERN) {
+        mf->chunk = kmalloc_node(SOURCE_CHUNK, GFP_KERNEL, mf->dev->node);
+        if (mf->chunk == NULL) {
+            mutex_unlock(&mf->lock);
+            return -ENOMEM;
+        }
+    }
+
+    if (src->mode == MYNULL_SRC_PATTERN) {
+        p = (u8 *)mf->chunk;
+        for (i = 0; i < SOURCE_CHUNK; i++)
+            p[i] = src->pattern[i % src->pattern_len];
+    }
+
+    mf->src = *src;
+    mutex_unlock(&mf->lock);
+    return 0;
+}
+
+static long set_sink(struct mynull_file *mf, const struct mynull_sink *sink)
+{
+    if (sink->mode > MYNULL_SINK_XXH64)
+        return -EINVAL;
+
+    mutex_lock(&mf->sink_lock);
+    if (mf->sink_chunk == NULL && sink->mode != MYNULL_SINK_NONE) {
+        mf->sink_chunk = kmalloc_node(SOURCE_CHUNK, GFP_KERNEL, mf->dev->node);
+        if (mf->sink_chunk == NULL) {
+            mutex_unlock(&mf->sink_lock);
+            return -ENOMEM;
+        }
+    }
+
+    mf->crc = ~0U;
+    xxh64_reset(&mf->xxh, sink->seed);
+    mf->sink_bytes = 0;
+    WRITE_ONCE(mf->sink_mode, sink->mode);
+    mutex_unlock(&mf->sink_lock);
+    return 0;
+}
+
+static void get_digest(struct mynull_file *mf, struct mynull_digest *d)
+{
+    mutex_lock(&mf->sink_lock);
+    switch (mf->sink_mode) {
+    case MYNULL_SINK_CRC32C:
+        d->digest = ~mf->crc;
+        break;
+    case MYNULL_SINK_XXH64:
+        d->digest = xxh64_digest(&mf->xxh);
+        break;
+    default:
+        d->digest = 0;
+        break;
+    }
+    d->bytes = mf->sink_bytes;
+    mutex_unlock(&mf->sink_lock);
+}
+
+static long ioctl_device(struct file *f, unsigned int cmd, unsigned long arg)
+{
+    struct mynull_file *mf = f->private_data;
+    struct mynull_source src;
+    struct mynull_sink sink;
+    struct mynull_digest digest;
+
+    switch (cmd) {
+    case MYNULL_SET_SOURCE:
+        if (copy_from_user(&src, (void __user *)arg, sizeof(src)))
+            return -EFAULT;
+        return set_source(mf, &src);
+    case MYNULL_GET_SOURCE:
+        mutex_lock(&mf->lock);
+        src = mf->src;
+        mutex_unlock(&mf->lock);
+        if (copy_to_user((void __user *)arg, &src, sizeof(src)))
+            return -EFAULT;
+        return 0;
+    case MYNULL_SET_SINK:
+        if (copy_from_user(&sink, (void __user *)arg, sizeof(sink)))
+            return -EFAULT;
+        return set_sink(mf, &sink);
+    case MYNULL_GET_DIGEST:
+        get_digest(mf, &digest);
+        if (copy_to_user((void __user *)arg, &digest, sizeof(digest)))
+            return -EFAULT;
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+/**
+ * Private mappings behave like /dev/zero: the vma is turned anonymous,
+ * read faults map the shared zero page and writes break COW, so a large
+ * mapping costs no memory until it is written.
+ */
+static int mmap_device(struct file *f, struct vm_area_struct *vma)
+{
+    trace_mynull_mmap(vma->vm_end - vma->vm_start, vma->vm_pgoff << PAGE_SHIFT);
+    mynull_log("mmap()\n");
+
+    if (vma->vm_flags & VM_SHARED)
+        return -EINVAL;
+
+    vma_set_anonymous(vma);
     return 0;
 }
 
-static ssize_t write_device(struct file *f, const char __user *buf, size_t len, loff_t *off)
+static int log_get(void *data, u64 *val)
 {
-    printk(KERN_INFO "Module: write()\n");
-    return len;
+    *val = static_key_enabled(&log_key);
+    return 0;
 }
 
+static int log_set(void *data, u64 val)
+{
+    if (val)
+        static_branch_enable(&log_key);
+    else
+        static_branch_disable(&log_key);
+    return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(log_fops, log_get, log_set, "%llu\n");
+
+static int instances_show(struct seq_file *sf, void *unused)
+{
+    unsigned long bytes;
+    unsigned int n;
+    int cpu;
+
+    seq_puts(sf, "minor node            opens    bytes_written\n");
+    for (n = 0; n < nr_minors; n++) {
+        bytes = 0;
+        for_each_possible_cpu(cpu)
+            bytes += *per_cpu_ptr(devs[n]->bytes_written, cpu);
+        seq_printf(sf, "%5u %4d %16ld %16lu\n", devs[n]->minor, devs[n]->node,
+                   atomic_long_read(&devs[n]->opens), bytes);
+    }
+    return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(instances);
+
 static struct file_operations pugs_fops =
 {
-    .owner   = THIS_MODULE,
-    .open    = open_device,
-    .read    = read_device,
-    .write   = write_device,
-    .release = close_device
+    .owner          = THIS_MODULE,
+    .open           = open_device,
+    .llseek         = no_seek_end_llseek,
+    .read_iter      = read_device,
+    .write_iter     = write_device,
+    .unlocked_ioctl = ioctl_device,
+    .compat_ioctl   = compat_ptr_ioctl,
+    .mmap           = mmap_device,
+    .splice_write   = splice_write_device,
+    .release        = close_device
 };
 
+/**
+ * Tear down the first n minors
+ */
+static void destroy_minors(unsigned int n)
+{
+    while (n-- > 0) {
+        device_destroy(cl, MKDEV(MAJOR(device_num), n));
+        cdev_del(&devs[n]->cdev);
+        free_percpu(devs[n]->bytes_written);
+        kfree(devs[n]);
+    }
+}
+
+/**
+ * Create /dev/mynull<n>, its state lives on the node of the CPUs
+ * steered to it by percpu_open so they only touch local memory.
+ */
+static int create_minor(unsigned int n)
+{
+    struct mynull_dev *dev;
+    int node = cpu_to_node(minor_to_cpu(n));
+    dev_t num = MKDEV(MAJOR(device_num), n);
+    struct device *d;
+
+    dev = kzalloc_node(sizeof(*dev), GFP_KERNEL, node);
+    if (dev == NULL)
+        return -ENOMEM;
+    dev->bytes_written = alloc_percpu(unsigned long);
+    if (dev->bytes_written == NULL) {
+        kfree(dev);
+        return -ENOMEM;
+    }
+
+    dev->minor = n;
+    dev->node = node;
+    cdev_init(&dev->cdev, &pugs_fops);
+    if (cdev_add(&dev->cdev, num, 1) < 0) {
+        free_percpu(dev->bytes_written);
+        kfree(dev);
+        return -1;
+    }
+
+    d = device_create(cl, NULL, num, NULL, "mynull%u", n);
+    if (IS_ERR_OR_NULL(d)) {
+        cdev_del(&dev->cdev);
+        free_percpu(dev->bytes_written);
+        kfree(dev);
+        return -1;
+    }
+
+    devs[n] = dev;
+    return 0;
+}
+
 /**
  * Initialize kernel module
  */
 int __init drive_init(void)
 {
+  unsigned int n;
+
   printk(KERN_INFO "Module registered");
 
-  if(alloc_chrdev_region(&device_num, 0, 1, "module") < 0) {
-	return -1;
+  if(nr_minors == 0 || nr_minors > MINORMASK) {
+    return -EINVAL;
   }
 
-  if((cl = class_create(THIS_MODULE, "null")) == NULL) {
-    unregister_chrdev_region(device_num, 1);
-    return -1;
+  if(fop_stats_init(&stats, op_names, MYNULL_NR_OPS) < 0) {
+    return -ENOMEM;
   }
 
-  if(device_create(cl, NULL, device_num, NULL, "mynull") == NULL) {
-    class_destroy(cl);
-    unregister_chrdev_region(device_num, 1);
-    return -1;
+  devs = kcalloc(nr_minors, sizeof(*devs), GFP_KERNEL);
+  if(devs == NULL) {
+    fop_stats_destroy(&stats);
+    return -ENOMEM;
   }
 
-  cdev_init(&c_dev, &pugs_fops);
+  if(alloc_chrdev_region(&device_num, 0, nr_minors, "module") < 0) {
+    kfree(devs);
+    fop_stats_destroy(&stats);
+    return -1;
+  }
 
-  if(cdev_add(&c_dev, device_num, 1) == -1) {
-    device_destroy(cl, device_num);
-    class_destroy(cl);
-    unregister_chrdev_region(device_num, 1);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+  cl = class_create("null");
+#else
+  cl = class_create(THIS_MODULE, "null");
+#endif
+  if(IS_ERR_OR_NULL(cl)) {
+    unregister_chrdev_region(device_num, nr_minors);
+    kfree(devs);
+    fop_stats_destroy(&stats);
     return -1;
   }
 
+  for(n = 0; n < nr_minors; n++) {
+    if(create_minor(n) < 0) {
+      destroy_minors(n);
+      class_destroy(cl);
+      unregister_chrdev_region(device_num, nr_minors);
+      kfree(devs);
+      fop_stats_destroy(&stats);
+      return -1;
+    }
+  }
+
+  debug_dir = debugfs_create_dir("mynull", NULL);
+  debugfs_create_file_unsafe("log", 0600, debug_dir, NULL, &log_fops);
+  debugfs_create_file("instances", 0400, debug_dir, NULL, &instances_fops);
+  fop_stats_debugfs(&stats, debug_dir);
+
   return 0;
 }
 
@@ -95,10 +710,12 @@ int __init drive_init(void)
  */
 void __exit drive_exit(void)
 {
-    cdev_del(&c_dev);
-    device_destroy(cl, device_num);
+    debugfs_remove_recursive(debug_dir);
+    destroy_minors(nr_minors);
     class_destroy(cl);
-    unregister_chrdev_region(device_num, 1);
+    unregister_chrdev_region(device_num, nr_minors);
+    kfree(devs);
+    fop_stats_destroy(&stats);
     printk(KERN_INFO "Good bay : module unregistered");
 }
 
@@ -0,0 +1,257 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/interrupt.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
+
+/**
+ * Null block device, /dev/mynullb0
+ *
+ * A blk-mq device whose requests complete without their data ever
+ * being touched, a stand-in disk to measure the block layer, the I/O
+ * scheduler and file systems in isolation.
+ *
+ * completion=1 ends every request from softirq context. The block
+ * layer's own deferral, blk_mq_complete_request(), completes inline
+ * when the request is on the CPU that submitted it, which is always
+ * the case with one hardware queue per CPU, so the requests go to a
+ * per-CPU list and a tasklet ends them.
+ */
+
+#define COMPLETE_INLINE     0
+#define COMPLETE_SOFTIRQ    1
+#define COMPLETE_TIMER      2
+
+static unsigned int nr_hw_queues;
+module_param(nr_hw_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(nr_hw_queues, "Hardware queues, 0 means one per CPU");
+
+static unsigned int queue_depth = 64;
+module_param(queue_depth, uint, S_IRUGO);
+MODULE_PARM_DESC(queue_depth, "Tags per hardware queue");
+
+static unsigned int block_size = 512;
+module_param(block_size, uint, S_IRUGO);
+MODULE_PARM_DESC(block_size, "Logical block size, 512 .. PAGE_SIZE");
+
+static unsigned long size_mb = 256 * 1024;
+module_param(size_mb, ulong, S_IRUGO);
+MODULE_PARM_DESC(size_mb, "Device size in MiB");
+
+static unsigned int completion = COMPLETE_INLINE;
+module_param(completion, uint, S_IRUGO);
+MODULE_PARM_DESC(completion, "0 inline, 1 softirq, 2 hrtimer after completion_nsec");
+
+static unsigned long completion_nsec = 10000;
+module_param(completion_nsec, ulong, S_IRUGO);
+MODULE_PARM_DESC(completion_nsec, "Completion latency of the hrtimer mode");
+
+/**
+ * Per-request driver data, allocated by blk-mq behind every request
+ */
+struct nullb_cmd {
+    struct hrtimer timer;
+    struct llist_node done_node;
+    struct request *rq;
+};
+
+/* Requests waiting for the softirq of their CPU */
+struct nullb_done {
+    struct llist_head list;
+    struct tasklet_struct tasklet;
+};
+
+static DEFINE_PER_CPU(struct nullb_done, nullb_done);
+
+static int major;
+static struct blk_mq_tag_set tag_set;
+static struct gendisk *disk;
+
+static enum hrtimer_restart nullb_timer_fn(struct hrtimer *timer)
+{
+    struct nullb_cmd *cmd = container_of(timer, struct nullb_cmd, timer);
+
+    blk_mq_end_request(cmd->rq, BLK_STS_OK);
+    return HRTIMER_NORESTART;
+}
+
+static void nullb_done_fn(struct tasklet_struct *t)
+{
+    struct nullb_done *done = from_tasklet(done, t, tasklet);
+    struct nullb_cmd *cmd, *next;
+    struct llist_node *list;
+
+    list = llist_del_all(&done->list);
+    llist_for_each_entry_safe(cmd, next, list, done_node)
+        blk_mq_end_request(cmd->rq, BLK_STS_OK);
+}
+
+/* The softirq runs at latest when local_bh_enable() is reached */
+static void nullb_complete_softirq(struct nullb_cmd *cmd)
+{
+    struct nullb_done *done;
+
+    local_bh_disable();
+    done = this_cpu_ptr(&nullb_done);
+    if (llist_add(&cmd->done_node, &done->list))
+        tasklet_schedule(&done->tasklet);
+    local_bh_enable();
+}
+
+static blk_status_t nullb_queue_rq(struct blk_mq_hw_ctx *hctx,
+                                   const struct blk_mq_queue_data *bd)
+{
+    struct request *rq = bd->rq;
+    struct nullb_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+    blk_mq_start_request(rq);
+
+    switch (completion) {
+    case COMPLETE_SOFTIRQ:
+        nullb_complete_softirq(cmd);
+        break;
+    case COMPLETE_TIMER:
+        hrtimer_start(&cmd->timer, ns_to_ktime(completion_nsec),
+                      HRTIMER_MODE_REL);
+        break;
+    default:
+        blk_mq_end_request(rq, BLK_STS_OK);
+        break;
+    }
+
+    return BLK_STS_OK;
+}
+
+static int nullb_init_request(struct blk_mq_tag_set *set, struct request *rq,
+                              unsigned int hctx_idx, unsigned int numa_node)
+{
+    struct nullb_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+    cmd->rq = rq;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&cmd->timer, nullb_timer_fn, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+    hrtimer_init(&cmd->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    cmd->timer.function = nullb_timer_fn;
+#endif
+    return 0;
+}
+
+static const struct blk_mq_ops nullb_mq_ops = {
+    .queue_rq     = nullb_queue_rq,
+    .init_request = nullb_init_request,
+};
+
+static const struct block_device_operations nullb_fops = {
+    .owner = THIS_MODULE,
+};
+
+/**
+ * Initialize kernel module
+ */
+static int __init nullb_init(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+    struct queue_limits lim = {
+        .logical_block_size  = block_size,
+        .physical_block_size = block_size,
+    };
+#endif
+    struct nullb_done *done;
+    int cpu, ret;
+
+    if (block_size < 512 || block_size > PAGE_SIZE || !is_power_of_2(block_size))
+        return -EINVAL;
+    if (completion > COMPLETE_TIMER || queue_depth == 0)
+        return -EINVAL;
+
+    for_each_possible_cpu(cpu) {
+        done = per_cpu_ptr(&nullb_done, cpu);
+        init_llist_head(&done->list);
+        tasklet_setup(&done->tasklet, nullb_done_fn);
+    }
+
+    major = register_blkdev(0, "mynullb");
+    if (major < 0)
+        return major;
+
+    tag_set.ops = &nullb_mq_ops;
+    tag_set.nr_hw_queues = nr_hw_queues ? nr_hw_queues : nr_cpu_ids;
+    tag_set.queue_depth = queue_depth;
+    tag_set.numa_node = NUMA_NO_NODE;
+    tag_set.cmd_size = sizeof(struct nullb_cmd);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+    tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+#endif
+
+    ret = blk_mq_alloc_tag_set(&tag_set);
+    if (ret)
+        goto out_blkdev;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+    disk = blk_mq_alloc_disk(&tag_set, &lim, NULL);
+#else
+    disk = blk_mq_alloc_disk(&tag_set, NULL);
+#endif
+    if (IS_ERR(disk)) {
+        ret = PTR_ERR(disk);
+        goto out_tag_set;
+    }
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 9, 0)
+    blk_queue_logical_block_size(disk->queue, block_size);
+    blk_queue_physical_block_size(disk->queue, block_size);
+    blk_queue_flag_set(QUEUE_FLAG_NONROT, disk->queue);
+#endif
+
+    disk->major = major;
+    disk->first_minor = 0;
+    disk->minors = 1;
+    disk->fops = &nullb_fops;
+    snprintf(disk->disk_name, DISK_NAME_LEN, "mynullb0");
+    set_capacity(disk, (sector_t)size_mb << (20 - SECTOR_SHIFT));
+
+    ret = add_disk(disk);
+    if (ret)
+        goto out_disk;
+
+    printk(KERN_INFO "mynullb0: %u queues, depth %u, %u byte blocks\n",
+           tag_set.nr_hw_queues, queue_depth, block_size);
+    return 0;
+
+out_disk:
+    put_disk(disk);
+out_tag_set:
+    blk_mq_free_tag_set(&tag_set);
+out_blkdev:
+    unregister_blkdev(major, "mynullb");
+    return ret;
+}
+
+/**
+ * Cleanup kernel module
+ */
+static void __exit nullb_exit(void)
+{
+    int cpu;
+
+    del_gendisk(disk);
+    /* every request has ended, a tasklet may still be on its way out */
+    for_each_possible_cpu(cpu)
+        tasklet_kill(&per_cpu_ptr(&nullb_done, cpu)->tasklet);
+    put_disk(disk);
+    blk_mq_free_tag_set(&tag_set);
+    unregister_blkdev(major, "mynullb");
+}
+
+module_init(nullb_init);
+module_exit(nullb_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Null block drive");
@@ -0,0 +1,73 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mynull
+
+#if !defined(_MODULE_NULL_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MODULE_NULL_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/sched.h>
+
+/**
+ * One event class shared by every file operation of /dev/mynull.
+ * open/close report a zero length and the current file position.
+ */
+DECLARE_EVENT_CLASS(mynull_fop,
+
+    TP_PROTO(size_t len, loff_t off),
+
+    TP_ARGS(len, off),
+
+    TP_STRUCT__entry(
+        __field(size_t, len)
+        __field(loff_t, off)
+        __field(pid_t,  pid)
+    ),
+
+    TP_fast_assign(
+        __entry->len = len;
+        __entry->off = off;
+        __entry->pid = current->pid;
+    ),
+
+    TP_printk("len=%zu off=%lld pid=%d",
+              __entry->len, __entry->off, __entry->pid)
+);
+
+DEFINE_EVENT(mynull_fop, mynull_open,
+    TP_PROTO(size_t len, loff_t off),
+    TP_ARGS(len, off)
+);
+
+DEFINE_EVENT(mynull_fop, mynull_close,
+    TP_PROTO(size_t len, loff_t off),
+    TP_ARGS(len, off)
+);
+
+DEFINE_EVENT(mynull_fop, mynull_read,
+    TP_PROTO(size_t len, loff_t off),
+    TP_ARGS(len, off)
+);
+
+DEFINE_EVENT(mynull_fop, mynull_write,
+    TP_PROTO(size_t len, loff_t off),
+    TP_ARGS(len, off)
+);
+
+DEFINE_EVENT(mynull_fop, mynull_splice,
+    TP_PROTO(size_t len, loff_t off),
+    TP_ARGS(len, off)
+);
+
+DEFINE_EVENT(mynull_fop, mynull_mmap,
+    TP_PROTO(size_t len, loff_t off),
+    TP_ARGS(len, off)
+);
+
+#endif /* _MODULE_NULL_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE module_null_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,70 @@
+#ifndef _MYNULL_IOCTL_H
+#define _MYNULL_IOCTL_H
+
+/**
+ * ioctl interface of /dev/mynullN, shared by the module and user space.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/**
+ * Read source modes. The stream is a pure function of the file offset,
+ * so pread(2) at any offset returns the same bytes as a sequential read.
+ */
+#define MYNULL_SRC_EOF      0   /* read returns 0, the default */
+#define MYNULL_SRC_ZERO     1   /* zeros */
+#define MYNULL_SRC_PATTERN  2   /* pattern[off % pattern_len] */
+#define MYNULL_SRC_COUNTER  3   /* u64 word i is seed + i, little endian */
+#define MYNULL_SRC_PRNG     4   /* u64 word i is splitmix64(seed, i) */
+
+#define MYNULL_PATTERN_MAX  64
+
+struct mynull_source {
+    __u32 mode;
+    __u32 pattern_len;
+    __u64 seed;
+    __u8  pattern[MYNULL_PATTERN_MAX];
+};
+
+#define MYNULL_SET_SOURCE   _IOW('N', 1, struct mynull_source)
+#define MYNULL_GET_SOURCE   _IOR('N', 2, struct mynull_source)
+
+/**
+ * Write sink modes. With a checksum selected every byte written to the
+ * file, by write(2), writev(2), io_uring or splice(2), is folded into a
+ * running digest, MYNULL_SET_SINK restarts it.
+ */
+#define MYNULL_SINK_NONE    0   /* discard, the default */
+#define MYNULL_SINK_CRC32C  1   /* CRC-32C (Castagnoli), seed ignored */
+#define MYNULL_SINK_XXH64   2   /* xxHash64 with the given seed */
+
+struct mynull_sink {
+    __u32 mode;
+    __u32 pad;
+    __u64 seed;
+};
+
+struct mynull_digest {
+    __u64 digest;
+    __u64 bytes;
+};
+
+#define MYNULL_SET_SINK     _IOW('N', 3, struct mynull_sink)
+#define MYNULL_GET_DIGEST   _IOR('N', 4, struct mynull_digest)
+
+/**
+ * Word i of the MYNULL_SRC_PRNG stream, splitmix64 of a Weyl sequence.
+ * It is counter based, any word can be computed without the ones
+ * before it.
+ */
+static inline __u64 mynull_splitmix64(__u64 seed, __u64 i)
+{
+    __u64 z = seed + (i + 1) * 0x9e3779b97f4a7c15ULL;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+#endif /* _MYNULL_IOCTL_H */
@@ -0,0 +1,138 @@
+/*
+ * Units per second of the batched race ioctls against one ioctl per
+ * unit. Every round attaches n units, queries them and detaches them
+ * again, one call per unit and then RACE_IOC_*_BATCH calls of each batch
+ * size; the batched rows should gain from the saved syscalls and lock
+ * round trips until the copies dominate.
+ *
+ *   ./bench_race_batch [units] [rounds] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "race_ioctl.h"
+
+static const int batch_sizes[] = { 1, 16, 256, 4096, 65536 };
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+/* One batched command over units[0..n) in calls of batch units */
+static void run_batch(int fd, unsigned long cmd, const char *name, int *units,
+                      int *status, long n, int batch)
+{
+    struct race_batch rb;
+    long i, j;
+
+    for (i = 0; i < n; i += batch) {
+        rb.units = (uintptr_t)(units + i);
+        rb.status = (uintptr_t)(status + i);
+        rb.count = n - i < batch ? n - i : batch;
+        rb.pad = 0;
+        if (ioctl(fd, cmd, &rb) < 0)
+            die(name);
+        for (j = 0; j < rb.count; j++)
+            if (status[i + j] != 0) {
+                fprintf(stderr, "%s: unit %d: %s\n", name, units[i + j],
+                        strerror(status[i + j]));
+                exit(1);
+            }
+    }
+}
+
+static void print_row(const char *mode, long n, double attach, double query,
+                      double detach)
+{
+    printf("%-8s %12.0f %12.0f %12.0f\n", mode, n / attach, n / query,
+           n / detach);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    long n = argc > 1 ? atol(argv[1]) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    const char *dev = argc > 3 ? argv[3] : "/dev/race";
+    double attach, query, detach, t;
+    int *units, *status, fd, r;
+    unsigned int b;
+    char mode[16];
+    long i;
+
+    if (n <= 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [units] [rounds] [device]\n", argv[0]);
+        return 1;
+    }
+    fd = open(dev, O_RDWR);
+    if (fd < 0)
+        die(dev);
+    units = calloc(n, sizeof(int));
+    status = calloc(n, sizeof(int));
+    if (units == NULL || status == NULL)
+        die("calloc");
+
+    printf("%-8s %12s %12s %12s\n", "batch", "attach/s", "query/s",
+           "detach/s");
+
+    attach = query = detach = 0;
+    for (r = 0; r < rounds; r++) {
+        t = now();
+        for (i = 0; i < n; i++)
+            if (ioctl(fd, RACE_IOC_ATTACH, &units[i]) < 0)
+                die("RACE_IOC_ATTACH");
+        attach += now() - t;
+        t = now();
+        for (i = 0; i < n; i++)
+            if (ioctl(fd, RACE_IOC_QUERY, &units[i]) < 0)
+                die("RACE_IOC_QUERY");
+        query += now() - t;
+        t = now();
+        for (i = 0; i < n; i++)
+            if (ioctl(fd, RACE_IOC_DETACH, &units[i]) < 0)
+                die("RACE_IOC_DETACH");
+        detach += now() - t;
+    }
+    print_row("single", n, attach / rounds, query / rounds, detach / rounds);
+
+    for (b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+        attach = query = detach = 0;
+        for (r = 0; r < rounds; r++) {
+            t = now();
+            run_batch(fd, RACE_IOC_ATTACH_BATCH, "RACE_IOC_ATTACH_BATCH",
+                      units, status, n, batch_sizes[b]);
+            attach += now() - t;
+            t = now();
+            run_batch(fd, RACE_IOC_QUERY_BATCH, "RACE_IOC_QUERY_BATCH",
+                      units, status, n, batch_sizes[b]);
+            query += now() - t;
+            t = now();
+            run_batch(fd, RACE_IOC_DETACH_BATCH, "RACE_IOC_DETACH_BATCH",
+                      units, status, n, batch_sizes[b]);
+            detach += now() - t;
+        }
+        snprintf(mode, sizeof(mode), "%d", batch_sizes[b]);
+        print_row(mode, n, attach / rounds, query / rounds, detach / rounds);
+    }
+
+    free(status);
+    free(units);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Attach/detach churn on the race driver from 1 to max_threads threads.
+ * Every thread attaches a unit and detaches it again in a loop; reports
+ * ns per attach/detach pair, total pairs/s and, when the files are
+ * readable, the softc cache activity during the step: allocations and
+ * objects carved from new slabs from the driver's debugfs file, the
+ * allocator's per-CPU fast and slow path allocations from SLUB (with
+ * CONFIG_SLUB_STATS).
+ *
+ *   ./bench_race_churn [max_threads] [seconds] [device] [cache_stats]
+ *
+ *   cache_stats defaults to /sys/kernel/debug/race/cache
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "race_ioctl.h"
+
+static const char *dev = "/dev/race";
+static volatile int stop;
+
+struct churner {
+    pthread_t thread;
+    long pairs;
+    double seconds;
+};
+
+struct cache_stats {
+    unsigned long allocs, frees, in_use, slab_objects;
+    unsigned long fastpath, slowpath;
+    int slub;
+};
+
+#define SLUB_DIR    "/sys/kernel/slab/race_softc/"
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void *churn_fn(void *arg)
+{
+    struct churner *c = arg;
+    int fd = open(dev, O_RDWR);
+    double start;
+    int unit;
+
+    if (fd < 0)
+        die(dev);
+    start = now();
+    while (!stop) {
+        if (ioctl(fd, RACE_IOC_ATTACH, &unit) < 0)
+            die("RACE_IOC_ATTACH");
+        if (ioctl(fd, RACE_IOC_DETACH, &unit) < 0)
+            die("RACE_IOC_DETACH");
+        c->pairs++;
+    }
+    c->seconds = now() - start;
+    close(fd);
+    return NULL;
+}
+
+/* First number of a SLUB stats file, the total over all CPUs */
+static int read_slub(const char *name, unsigned long *v)
+{
+    FILE *f = fopen(name, "r");
+    int n;
+
+    if (f == NULL)
+        return 0;
+    n = fscanf(f, "%lu", v);
+    fclose(f);
+    return n == 1;
+}
+
+/* The counters line of the cache stats file, 0 when it cannot be read */
+static int read_cache(const char *path, struct cache_stats *cs)
+{
+    FILE *f = fopen(path, "r");
+    int n;
+
+    cs->slub = read_slub(SLUB_DIR "alloc_fastpath", &cs->fastpath) &&
+               read_slub(SLUB_DIR "alloc_slowpath", &cs->slowpath);
+    if (f == NULL)
+        return 0;
+    n = fscanf(f, "%*[^\n] %lu %lu %lu %lu", &cs->allocs, &cs->frees,
+               &cs->in_use, &cs->slab_objects);
+    fclose(f);
+    return n == 4;
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    double seconds = argc > 2 ? atof(argv[2]) : 2;
+    const char *stats = argc > 4 ? argv[4] : "/sys/kernel/debug/race/cache";
+    struct cache_stats before, after;
+    struct churner *c;
+    int threads, i, have_stats;
+    double ns;
+    long pairs;
+
+    if (argc > 3)
+        dev = argv[3];
+    if (max_threads <= 0 || seconds <= 0) {
+        fprintf(stderr, "usage: %s [max_threads] [seconds] [device] "
+                "[cache_stats]\n", argv[0]);
+        return 1;
+    }
+    c = calloc(max_threads, sizeof(*c));
+    if (c == NULL)
+        die("calloc");
+    if (!read_cache(stats, &before))
+        fprintf(stderr, "%s: cache counters not available\n", stats);
+
+    printf("%8s %10s %12s %12s %12s %12s %12s\n", "threads", "ns/pair",
+           "pairs/s", "allocs", "slab_objects", "fastpath", "slowpath");
+    for (threads = 1; threads <= max_threads; threads *= 2) {
+        have_stats = read_cache(stats, &before);
+        stop = 0;
+        for (i = 0; i < threads; i++) {
+            c[i].pairs = 0;
+            if (pthread_create(&c[i].thread, NULL, churn_fn, &c[i]) != 0)
+                die("pthread_create");
+        }
+        usleep(seconds * 1e6);
+        stop = 1;
+        for (ns = 0, pairs = 0, i = 0; i < threads; i++) {
+            pthread_join(c[i].thread, NULL);
+            pairs += c[i].pairs;
+            ns += c[i].seconds * 1e9;
+        }
+        /* a pair costs thread time, so this is the per thread figure */
+        printf("%8d %10.0f %12.0f", threads, ns / (pairs ? pairs : 1),
+               pairs / seconds);
+        if (read_cache(stats, &after) && have_stats)
+            printf(" %12lu %12lu", after.allocs - before.allocs,
+                   after.slab_objects - before.slab_objects);
+        else
+            printf(" %12s %12s", "-", "-");
+        if (before.slub && after.slub)
+            printf(" %12lu %12lu\n", after.fastpath - before.fastpath,
+                   after.slowpath - before.slowpath);
+        else
+            printf(" %12s %12s\n", "-", "-");
+        fflush(stdout);
+    }
+
+    free(c);
+    return 0;
+}
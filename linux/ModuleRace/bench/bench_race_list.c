@@ -0,0 +1,184 @@
+/*
+ * Lists every unit with RACE_IOC_LIST_UNITS while other threads keep
+ * attaching and detaching. The units attached up front stay attached
+ * for the whole walk, so each of them must come back exactly once and
+ * the list must be in ascending order; units of the attach threads may
+ * or may not show up. Reports the walk time for every page size and
+ * fails on a missing, repeated or out of order unit.
+ *
+ *   ./bench_race_list [units] [attach_threads] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "race_ioctl.h"
+
+static const unsigned int page_sizes[] = { 64, 1024, 16384, 65536 };
+
+static const char *dev = "/dev/race";
+static volatile int stop;
+
+struct attacher {
+    pthread_t thread;
+    long ops;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void *attacher_fn(void *arg)
+{
+    struct attacher *a = arg;
+    int fd = open(dev, O_RDWR);
+    int unit;
+
+    if (fd < 0)
+        die(dev);
+    while (!stop) {
+        if (ioctl(fd, RACE_IOC_ATTACH, &unit) < 0)
+            die("RACE_IOC_ATTACH");
+        if (ioctl(fd, RACE_IOC_DETACH, &unit) < 0)
+            die("RACE_IOC_DETACH");
+        a->ops++;
+    }
+    close(fd);
+    return NULL;
+}
+
+/* Attach or detach units[0..n) in RACE_BATCH_MAX batches */
+static void batch(int fd, unsigned long cmd, int *units, int *status, long n)
+{
+    struct race_batch rb;
+    long i, j;
+
+    for (i = 0; i < n; i += RACE_BATCH_MAX) {
+        rb.units = (uintptr_t)(units + i);
+        rb.status = (uintptr_t)(status + i);
+        rb.count = n - i < RACE_BATCH_MAX ? n - i : RACE_BATCH_MAX;
+        rb.pad = 0;
+        if (ioctl(fd, cmd, &rb) < 0)
+            die("RACE_IOC_*_BATCH");
+        for (j = 0; j < rb.count; j++)
+            if (status[i + j] != 0) {
+                fprintf(stderr, "unit %d: %s\n", units[i + j],
+                        strerror(status[i + j]));
+                exit(1);
+            }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    int nr_attachers = argc > 2 ? atoi(argv[2]) : 4;
+    struct attacher *attachers;
+    int *units, *status, *page, fd, i, bad = 0;
+    unsigned char *seen;
+    unsigned int p, j;
+    long listed, extra, ops;
+    double t;
+
+    if (argc > 3)
+        dev = argv[3];
+    if (n <= 0 || nr_attachers < 0) {
+        fprintf(stderr, "usage: %s [units] [attach_threads] [device]\n",
+                argv[0]);
+        return 1;
+    }
+    fd = open(dev, O_RDWR);
+    if (fd < 0)
+        die(dev);
+    units = calloc(n, sizeof(int));
+    status = calloc(n, sizeof(int));
+    page = calloc(RACE_BATCH_MAX, sizeof(int));
+    attachers = calloc(nr_attachers ? nr_attachers : 1, sizeof(*attachers));
+    if (units == NULL || status == NULL || page == NULL || attachers == NULL)
+        die("calloc");
+
+    batch(fd, RACE_IOC_ATTACH_BATCH, units, status, n);
+    /* the units are the lowest free ones, the attachers get higher ones */
+    seen = calloc(units[n - 1] + 1, 1);
+    if (seen == NULL)
+        die("calloc");
+
+    for (i = 0; i < nr_attachers; i++)
+        if (pthread_create(&attachers[i].thread, NULL, attacher_fn,
+                           &attachers[i]) != 0)
+            die("pthread_create");
+
+    printf("%8s %10s %10s %8s %12s\n", "page", "listed", "extra", "ms",
+           "units/s");
+    for (p = 0; p < sizeof(page_sizes) / sizeof(page_sizes[0]); p++) {
+        struct race_list rl = { .units = (uintptr_t)page,
+                                .max = page_sizes[p] };
+        int last = -1;
+
+        memset(seen, 0, units[n - 1] + 1);
+        listed = extra = 0;
+        t = now();
+        do {
+            if (ioctl(fd, RACE_IOC_LIST_UNITS, &rl) < 0)
+                die("RACE_IOC_LIST_UNITS");
+            for (j = 0; j < rl.count; j++) {
+                if (page[j] <= last) {
+                    fprintf(stderr, "unit %d after %d\n", page[j], last);
+                    bad = 1;
+                }
+                last = page[j];
+                if (page[j] > units[n - 1])
+                    extra++;
+                else if (seen[page[j]]++)
+                    bad = 1;
+            }
+            listed += rl.count;
+        } while (rl.cursor >= 0);
+        t = now() - t;
+
+        for (i = 0; i < n; i++)
+            if (seen[units[i]] != 1) {
+                fprintf(stderr, "unit %d listed %d times\n", units[i],
+                        seen[units[i]]);
+                bad = 1;
+                break;
+            }
+        printf("%8u %10ld %10ld %8.1f %12.0f\n", page_sizes[p], listed, extra,
+               t * 1e3, listed / t);
+        fflush(stdout);
+    }
+
+    stop = 1;
+    for (ops = 0, i = 0; i < nr_attachers; i++) {
+        pthread_join(attachers[i].thread, NULL);
+        ops += attachers[i].ops;
+    }
+    printf("%ld concurrent attach/detach pairs\n", ops);
+
+    batch(fd, RACE_IOC_DETACH_BATCH, units, status, n);
+    free(seen);
+    free(attachers);
+    free(page);
+    free(status);
+    free(units);
+    close(fd);
+    if (bad)
+        fprintf(stderr, "list check FAILED\n");
+    return bad;
+}
@@ -0,0 +1,154 @@
+/*
+ * RACE_IOC_QUERY throughput against the number of threads. The units
+ * are attached first, then every thread queries random ones; with
+ * lockless queries the total should grow with the thread count. With
+ * churn set one more thread keeps attaching and detaching a unit.
+ *
+ *   ./bench_race_query [max_threads] [seconds] [units] [churn] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "race_ioctl.h"
+
+static const char *dev = "/dev/race";
+static long units = 100000;
+static volatile int stop;
+
+struct client {
+    pthread_t thread;
+    int id;
+    long ops;
+    long errors;
+};
+
+static void *client_fn(void *arg)
+{
+    struct client *c = arg;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL * (c->id + 1);
+    int fd = open(dev, O_RDWR);
+    int unit;
+
+    if (fd < 0) {
+        perror(dev);
+        exit(1);
+    }
+
+    while (!stop) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        unit = seed % units;
+        if (ioctl(fd, RACE_IOC_QUERY, &unit) < 0)
+            c->errors++;
+        c->ops++;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+/* Attach a unit past the queried ones and detach it again */
+static void *churn_fn(void *arg)
+{
+    struct client *c = arg;
+    int fd = open(dev, O_RDWR);
+    int unit;
+
+    if (fd < 0) {
+        perror(dev);
+        exit(1);
+    }
+
+    while (!stop) {
+        if (ioctl(fd, RACE_IOC_ATTACH, &unit) < 0 ||
+            ioctl(fd, RACE_IOC_DETACH, &unit) < 0)
+            c->errors++;
+        c->ops++;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    int seconds = argc > 2 ? atoi(argv[2]) : 2;
+    int churn = argc > 4 ? atoi(argv[4]) : 0;
+    struct client *clients, writer;
+    long i;
+    int n, fd, unit;
+
+    if (argc > 3)
+        units = atol(argv[3]);
+    if (argc > 5)
+        dev = argv[5];
+    if (units < 1) {
+        fprintf(stderr, "units must be positive\n");
+        return 1;
+    }
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        perror(dev);
+        return 1;
+    }
+    for (i = 0; i < units; i++) {
+        if (ioctl(fd, RACE_IOC_ATTACH, &unit) < 0) {
+            perror("RACE_IOC_ATTACH");
+            return 1;
+        }
+        if (unit >= units) {
+            fprintf(stderr, "/dev/race is in use, unit %d attached\n", unit);
+            return 1;
+        }
+    }
+
+    clients = calloc(max_threads, sizeof(*clients));
+    if (clients == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    printf("%8s %14s %14s %8s %12s\n", "threads", "queries/s", "per_thread",
+           "errors", "churn/s");
+    for (n = 1; n <= max_threads; n <<= 1) {
+        long ops = 0, errors = 0;
+
+        memset(clients, 0, n * sizeof(*clients));
+        memset(&writer, 0, sizeof(writer));
+        stop = 0;
+        for (i = 0; i < n; i++) {
+            clients[i].id = i;
+            pthread_create(&clients[i].thread, NULL, client_fn, &clients[i]);
+        }
+        if (churn)
+            pthread_create(&writer.thread, NULL, churn_fn, &writer);
+        sleep(seconds);
+        stop = 1;
+        for (i = 0; i < n; i++) {
+            pthread_join(clients[i].thread, NULL);
+            ops += clients[i].ops;
+            errors += clients[i].errors;
+        }
+        if (churn)
+            pthread_join(writer.thread, NULL);
+
+        printf("%8d %14.0f %14.0f %8ld %12.0f\n", n, (double)ops / seconds,
+               (double)ops / seconds / n, errors + writer.errors,
+               (double)writer.ops / seconds);
+    }
+
+    for (unit = units - 1; unit >= 0; unit--)
+        ioctl(fd, RACE_IOC_DETACH, &unit);
+    close(fd);
+    free(clients);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Latency of the race driver ioctls as the number of attached units
+ * grows from 10 to 10M. At every step the population is grown by
+ * attaching, then random units are queried and a unit is attached and
+ * detached again; all of it should stay flat as the count grows.
+ *
+ *   ./bench_race_scale [max_units] [ops_per_step] [device]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "race_ioctl.h"
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+int main(int argc, char **argv)
+{
+    long max = argc > 1 ? atol(argv[1]) : 10000000;
+    long ops = argc > 2 ? atol(argv[2]) : 100000;
+    const char *dev = argc > 3 ? argv[3] : "/dev/race";
+    uint64_t seed = 88172645463325252ULL;
+    long units = 0, step, i;
+    double t, t_grow;
+    int fd, unit;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0)
+        die(dev);
+
+    printf("%10s %12s %10s %14s\n", "units", "attach_ns", "query_ns",
+           "attach+det_ns");
+    for (step = 10; step <= max; step *= 10) {
+        long before = units;
+        double grow, query, pair;
+
+        t_grow = now();
+        for (; units < step; units++)
+            if (ioctl(fd, RACE_IOC_ATTACH, &unit) < 0)
+                die("RACE_IOC_ATTACH");
+        grow = (now() - t_grow) / (step - before);
+
+        t = now();
+        for (i = 0; i < ops; i++) {
+            unit = xorshift(&seed) % units;
+            if (ioctl(fd, RACE_IOC_QUERY, &unit) < 0)
+                die("RACE_IOC_QUERY");
+        }
+        query = (now() - t) / ops;
+
+        t = now();
+        for (i = 0; i < ops; i++) {
+            if (ioctl(fd, RACE_IOC_ATTACH, &unit) < 0)
+                die("RACE_IOC_ATTACH");
+            if (ioctl(fd, RACE_IOC_DETACH, &unit) < 0)
+                die("RACE_IOC_DETACH");
+        }
+        pair = (now() - t) / ops;
+
+        printf("%10ld %12.0f %10.0f %14.0f\n", units, grow * 1e9, query * 1e9,
+               pair * 1e9);
+        fflush(stdout);
+    }
+
+    t = now();
+    for (unit = units - 1; unit >= 0; unit--)
+        if (ioctl(fd, RACE_IOC_DETACH, &unit) < 0)
+            die("RACE_IOC_DETACH");
+    printf("detached %ld units, %.0f ns each\n", units,
+           (now() - t) / (units ? units : 1) * 1e9);
+
+    close(fd);
+    return 0;
+}
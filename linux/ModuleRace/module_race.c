@@ -0,0 +1,513 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/cdev.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/percpu.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "race_ioctl.h"
+#include "race_registry.h"
+
+/**
+ * Linux port of the FreeBSD race driver, /dev/race
+ *
+ * RACE_IOC_ATTACH creates a unit, RACE_IOC_DETACH destroys it and
+ * RACE_IOC_QUERY checks that it exists. Units are kept in the registry
+ * shared with the FreeBSD driver, race_registry.h, so allocating and
+ * finding one costs the same at 10 or 10 million units.
+ *
+ * race_lock serializes attach and detach. Query takes no lock, it runs
+ * under rcu_read_lock() and a detached softc is freed after a grace
+ * period. RACE_IOC_LIST, RACE_IOC_LIST_UNITS and the debugfs units file
+ * only read the registry bitmaps and need neither.
+ *
+ * Softcs come from their own cache-line aligned kmem_cache, attach and
+ * detach churn is served from its per-CPU slabs instead of kmalloc.
+ */
+
+struct race_softc {
+    int unit;
+    struct rcu_head rcu;
+};
+
+static DEFINE_MUTEX(race_lock);
+static struct race_reg race_units;
+
+static dev_t race_num;
+static struct cdev race_cdev;
+static struct class *race_class;
+static struct dentry *race_debug_dir;
+
+/* Units per snapshot and runs of units logged by RACE_IOC_LIST */
+#define RACE_LIST_PAGE  1024
+#define RACE_LIST_LINES 64
+
+/**
+ * Allocations from race_cache, shown in /sys/kernel/debug/race/cache.
+ * The constructor runs for every object of a new slab, so slab_objects
+ * counts the objects carved from new slabs. The per-CPU slab hits and
+ * misses are the allocator's own alloc_fastpath and alloc_slowpath in
+ * /sys/kernel/slab/race_softc with CONFIG_SLUB_STATS.
+ */
+struct race_cache_stats {
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long slab_objects;
+};
+
+static struct kmem_cache *race_cache;
+static DEFINE_PER_CPU(struct race_cache_stats, race_cache_stats);
+
+static void
+race_softc_ctor(void *p)
+{
+    this_cpu_inc(race_cache_stats.slab_objects);
+}
+
+static struct race_softc *
+race_alloc(void)
+{
+    struct race_softc *sc;
+
+    /* no __GFP_ZERO with a constructor, the fields are set on insert */
+    sc = kmem_cache_alloc(race_cache, GFP_KERNEL);
+    if (sc != NULL)
+        this_cpu_inc(race_cache_stats.allocs);
+    return sc;
+}
+
+static void
+race_free(void *sc)
+{
+    kmem_cache_free(race_cache, sc);
+    this_cpu_inc(race_cache_stats.frees);
+}
+
+static int
+race_new(struct race_softc **scp)
+{
+    struct race_softc *sc;
+    int error;
+
+    sc = race_alloc();
+    if (sc == NULL)
+        return -ENOMEM;
+    error = race_reg_insert(&race_units, sc, &sc->unit);
+    if (error) {
+        race_free(sc);
+        return -error;
+    }
+    *scp = sc;
+    return 0;
+}
+
+static struct race_softc *
+race_find(int unit)
+{
+    return race_reg_find(&race_units, unit);
+}
+
+static void
+race_free_rcu(struct rcu_head *rcu)
+{
+    race_free(container_of(rcu, struct race_softc, rcu));
+}
+
+static void
+race_destroy(struct race_softc *sc)
+{
+    race_reg_remove(&race_units, sc->unit);
+    call_rcu(&sc->rcu, race_free_rcu);
+}
+
+/* Print one run of consecutive units unless RACE_LIST_LINES were printed */
+static void
+race_list_run(int first, int last, unsigned int *lines)
+{
+    if (first < 0 || (*lines)++ >= RACE_LIST_LINES)
+        return;
+    if (first == last)
+        printk(KERN_INFO " %d\n", first);
+    else
+        printk(KERN_INFO " %d-%d\n", first, last);
+}
+
+/**
+ * RACE_IOC_LIST, the units in the kernel log like uprintf(9) output on
+ * FreeBSD. The units are taken a page at a time with race_reg_snapshot(),
+ * which needs no lock, and logged as runs of consecutive units. Past
+ * RACE_LIST_LINES runs only the count is logged, all units are in
+ * /sys/kernel/debug/race/units.
+ */
+static long
+race_list(void)
+{
+    int *units, cursor = 0, first = -1, last = -1;
+    unsigned int i, n, lines = 0;
+    unsigned long total = 0;
+
+    units = kmalloc_array(RACE_LIST_PAGE, sizeof(int), GFP_KERNEL);
+    if (units == NULL)
+        return -ENOMEM;
+    printk(KERN_INFO " UNIT\n");
+    do {
+        n = race_reg_snapshot(&race_units, &cursor, units, RACE_LIST_PAGE);
+        for (i = 0; i < n; i++) {
+            if (first < 0 || units[i] != last + 1) {
+                race_list_run(first, last, &lines);
+                first = units[i];
+            }
+            last = units[i];
+        }
+        total += n;
+        cond_resched();
+    } while (cursor >= 0);
+    race_list_run(first, last, &lines);
+    if (lines > RACE_LIST_LINES)
+        printk(KERN_INFO " ... %u more runs\n", lines - RACE_LIST_LINES);
+    printk(KERN_INFO " %lu units\n", total);
+    kfree(units);
+    return 0;
+}
+
+/**
+ * One page of RACE_IOC_LIST_UNITS. The snapshot reads only the registry
+ * bitmaps, so it takes neither race_lock nor RCU, and is copied out
+ * from the private copy.
+ */
+static long
+race_list_units(struct race_list __user *ulist)
+{
+    struct race_list list;
+    long error = 0;
+    int *units;
+
+    if (copy_from_user(&list, ulist, sizeof(list)))
+        return -EFAULT;
+    if (list.max == 0 || list.max > RACE_BATCH_MAX)
+        return -EINVAL;
+    units = kvmalloc_array(list.max, sizeof(int), GFP_KERNEL);
+    if (units == NULL)
+        return -ENOMEM;
+    list.count = race_reg_snapshot(&race_units, &list.cursor, units, list.max);
+    if (copy_to_user(u64_to_user_ptr(list.units), units,
+                     list.count * sizeof(int)) ||
+        copy_to_user(ulist, &list, sizeof(list)))
+        error = -EFAULT;
+    kvfree(units);
+    return error;
+}
+
+/*
+ * /sys/kernel/debug/race/units, one attached unit per line. The file
+ * position is the unit number, so a read picks up after the last unit
+ * it returned like RACE_IOC_LIST_UNITS does.
+ */
+static void *
+race_unit_seq_start(struct seq_file *sf, loff_t *pos)
+{
+    int unit;
+
+    if (*pos >= RACE_REG_MAX_UNITS)
+        return NULL;
+    unit = race_reg_next(&race_units, *pos);
+    if (unit < 0)
+        return NULL;
+    *pos = unit;
+    return pos;
+}
+
+static void *
+race_unit_seq_next(struct seq_file *sf, void *v, loff_t *pos)
+{
+    ++*pos;
+    return race_unit_seq_start(sf, pos);
+}
+
+static void
+race_unit_seq_stop(struct seq_file *sf, void *v)
+{
+}
+
+static int
+race_unit_seq_show(struct seq_file *sf, void *v)
+{
+    seq_printf(sf, "%lld\n", *(loff_t *)v);
+    return 0;
+}
+
+static const struct seq_operations race_unit_sops = {
+    .start  = race_unit_seq_start,
+    .next   = race_unit_seq_next,
+    .stop   = race_unit_seq_stop,
+    .show   = race_unit_seq_show,
+};
+
+DEFINE_SEQ_ATTRIBUTE(race_unit);
+
+static int
+race_cache_show(struct seq_file *sf, void *unused)
+{
+    struct race_cache_stats *st, sum = { 0 };
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        st = per_cpu_ptr(&race_cache_stats, cpu);
+        sum.allocs += st->allocs;
+        sum.frees += st->frees;
+        sum.slab_objects += st->slab_objects;
+    }
+    seq_puts(sf, "      allocs        frees       in_use slab_objects\n");
+    seq_printf(sf, "%12lu %12lu %12lu %12lu\n", sum.allocs, sum.frees,
+               sum.allocs - sum.frees, sum.slab_objects);
+    return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(race_cache);
+
+/**
+ * Run a batch, see race_ioctl.h. The softcs of an attach batch are
+ * allocated before race_lock is taken. Its status and unit arrays are
+ * copied out under the lock, so when that faults the new units can be
+ * detached again before any other detach could reach them; the other
+ * batches copy out after the lock or RCU section.
+ */
+static long
+race_batch(unsigned int cmd, struct race_batch __user *ubatch)
+{
+    struct race_softc **scs = NULL, *sc;
+    struct race_batch batch;
+    int *units, *status;
+    long error = 0;
+    size_t len;
+    u32 i;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    if (batch.count > RACE_BATCH_MAX)
+        return -EINVAL;
+    len = batch.count * sizeof(int);
+    units = kvmalloc_array(max(batch.count, 1U), 2 * sizeof(int), GFP_KERNEL);
+    if (units == NULL)
+        return -ENOMEM;
+    status = units + batch.count;
+
+    if (cmd == RACE_IOC_ATTACH_BATCH) {
+        scs = kvmalloc_array(max(batch.count, 1U), sizeof(*scs), GFP_KERNEL);
+        if (scs == NULL) {
+            error = -ENOMEM;
+            goto out;
+        }
+        /* a softc that cannot be allocated fails its own entry */
+        for (i = 0; i < batch.count; i++)
+            scs[i] = race_alloc();
+    } else if (copy_from_user(units, u64_to_user_ptr(batch.units), len)) {
+        error = -EFAULT;
+        goto out;
+    }
+
+    switch (cmd) {
+    case RACE_IOC_ATTACH_BATCH:
+        mutex_lock(&race_lock);
+        for (i = 0; i < batch.count; i++) {
+            status[i] = scs[i] ? race_reg_insert(&race_units, scs[i],
+                                                 &scs[i]->unit) : ENOMEM;
+            if (status[i] == 0) {
+                units[i] = scs[i]->unit;
+            } else {
+                if (scs[i] != NULL)
+                    race_free(scs[i]);
+                units[i] = -1;
+            }
+        }
+        if (copy_to_user(u64_to_user_ptr(batch.status), status, len) ||
+            copy_to_user(u64_to_user_ptr(batch.units), units, len)) {
+            for (i = 0; i < batch.count; i++)
+                if (status[i] == 0)
+                    race_destroy(scs[i]);
+            error = -EFAULT;
+        }
+        mutex_unlock(&race_lock);
+        goto out;
+    case RACE_IOC_DETACH_BATCH:
+        mutex_lock(&race_lock);
+        for (i = 0; i < batch.count; i++) {
+            sc = race_find(units[i]);
+            if (sc != NULL)
+                race_destroy(sc);
+            status[i] = sc != NULL ? 0 : ENOENT;
+        }
+        mutex_unlock(&race_lock);
+        break;
+    case RACE_IOC_QUERY_BATCH:
+        rcu_read_lock();
+        for (i = 0; i < batch.count; i++)
+            status[i] = race_find(units[i]) != NULL ? 0 : ENOENT;
+        rcu_read_unlock();
+        break;
+    }
+
+    if (copy_to_user(u64_to_user_ptr(batch.status), status, len))
+        error = -EFAULT;
+out:
+    kvfree(scs);
+    kvfree(units);
+    return error;
+}
+
+static long
+race_ioctl_locked(unsigned int cmd, unsigned long arg)
+{
+    struct race_softc *sc;
+    int error = 0, unit;
+
+    switch (cmd) {
+    case RACE_IOC_ATTACH:
+        error = race_new(&sc);
+        if (error)
+            break;
+        /* a unit nobody learned the number of could never be detached */
+        error = put_user(sc->unit, (int __user *)arg);
+        if (error)
+            race_destroy(sc);
+        break;
+    case RACE_IOC_DETACH:
+        if (get_user(unit, (int __user *)arg))
+            return -EFAULT;
+        sc = race_find(unit);
+        if (sc == NULL)
+            return -ENOENT;
+        race_destroy(sc);
+        break;
+    default:
+        error = -ENOTTY;
+        break;
+    }
+
+    return error;
+}
+
+static long
+race_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+    long error = 0;
+    int unit;
+
+    switch (cmd) {
+    case RACE_IOC_ATTACH_BATCH:
+    case RACE_IOC_DETACH_BATCH:
+    case RACE_IOC_QUERY_BATCH:
+        return race_batch(cmd, (struct race_batch __user *)arg);
+    case RACE_IOC_LIST_UNITS:
+        return race_list_units((struct race_list __user *)arg);
+    case RACE_IOC_QUERY:
+        if (get_user(unit, (int __user *)arg))
+            return -EFAULT;
+        rcu_read_lock();
+        if (race_find(unit) == NULL)
+            error = -ENOENT;
+        rcu_read_unlock();
+        return error;
+    case RACE_IOC_LIST:
+        return race_list();
+    }
+
+    mutex_lock(&race_lock);
+    error = race_ioctl_locked(cmd, arg);
+    mutex_unlock(&race_lock);
+    return error;
+}
+
+static struct file_operations race_fops = {
+    .owner          = THIS_MODULE,
+    .unlocked_ioctl = race_ioctl,
+    .compat_ioctl   = compat_ptr_ioctl,
+};
+
+/**
+ * Initialize kernel module
+ */
+static int __init
+race_init(void)
+{
+    int error;
+
+    race_cache = kmem_cache_create("race_softc", sizeof(struct race_softc), 0,
+                                   SLAB_HWCACHE_ALIGN, race_softc_ctor);
+    if (race_cache == NULL)
+        return -ENOMEM;
+
+    error = alloc_chrdev_region(&race_num, 0, 1, RACE_NAME);
+    if (error < 0)
+        goto out_cache;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    race_class = class_create(RACE_NAME);
+#else
+    race_class = class_create(THIS_MODULE, RACE_NAME);
+#endif
+    if (IS_ERR(race_class)) {
+        error = PTR_ERR(race_class);
+        goto out_region;
+    }
+
+    cdev_init(&race_cdev, &race_fops);
+    error = cdev_add(&race_cdev, race_num, 1);
+    if (error < 0)
+        goto out_class;
+
+    if (IS_ERR(device_create(race_class, NULL, race_num, NULL, RACE_NAME))) {
+        error = -ENODEV;
+        goto out_cdev;
+    }
+
+    race_debug_dir = debugfs_create_dir(RACE_NAME, NULL);
+    debugfs_create_file("units", 0400, race_debug_dir, NULL, &race_unit_fops);
+    debugfs_create_file("cache", 0400, race_debug_dir, NULL, &race_cache_fops);
+
+    printk(KERN_INFO "Race driver loaded.\n");
+    return 0;
+
+out_cdev:
+    cdev_del(&race_cdev);
+out_class:
+    class_destroy(race_class);
+out_region:
+    unregister_chrdev_region(race_num, 1);
+out_cache:
+    kmem_cache_destroy(race_cache);
+    return error;
+}
+
+/**
+ * Cleanup kernel module
+ */
+static void __exit
+race_exit(void)
+{
+    debugfs_remove_recursive(race_debug_dir);
+    device_destroy(race_class, race_num);
+    cdev_del(&race_cdev);
+    class_destroy(race_class);
+    unregister_chrdev_region(race_num, 1);
+    race_reg_destroy(&race_units, race_free);
+    /* softcs detached last may still wait for their grace period */
+    rcu_barrier();
+    kmem_cache_destroy(race_cache);
+    printk(KERN_INFO "Race driver unloaded.\n");
+}
+
+module_init(race_init);
+module_exit(race_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Race driver");
@@ -0,0 +1,320 @@
+/*
+ * Messages/sec and round-trip latency of the shared-memory SPSC ring
+ * compared with pipes, for a few message sizes. Round trips use two
+ * rings, /dev/spsc0 for ping and /dev/spsc1 for pong.
+ *
+ *   ./bench_ring [messages] [cpu_a] [cpu_b]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "ring_ioctl.h"
+
+#define PAD_RECORD  UINT32_MAX
+#define SPIN_MIN    16
+#define SPIN_MAX    (1 << 17)
+
+struct ring {
+    int fd;
+    struct ring_ctrl *ctrl;
+    uint8_t *data;
+    uint64_t mask;
+    unsigned int spin;      /* adaptive spin budget before sleeping */
+};
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        die("sched_setaffinity");
+}
+
+static void ring_open(struct ring *r, const char *path)
+{
+    struct ring_ctrl *ctrl;
+    void *p;
+
+    r->fd = open(path, O_RDWR);
+    if (r->fd < 0)
+        die(path);
+    ctrl = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+    if (ctrl == MAP_FAILED)
+        die("mmap ctrl");
+    p = mmap(NULL, ctrl->data_offset + ctrl->size, PROT_READ | PROT_WRITE,
+             MAP_SHARED, r->fd, 0);
+    if (p == MAP_FAILED)
+        die("mmap ring");
+    munmap(ctrl, 4096);
+
+    r->ctrl = p;
+    r->data = (uint8_t *)p + r->ctrl->data_offset;
+    r->mask = r->ctrl->size - 1;
+    r->spin = 1024;
+}
+
+static void ring_reset(struct ring *r)
+{
+    r->ctrl->head = 0;
+    r->ctrl->tail = 0;
+    r->ctrl->consumer_waiting = 0;
+    r->ctrl->producer_waiting = 0;
+}
+
+/**
+ * Wait until *counter moves away from seen. Spin first, the budget
+ * doubles when spinning pays off and halves when we end up sleeping.
+ */
+static void ring_wait(struct ring *r, __u64 *counter, __u32 *waiting,
+                      unsigned long cmd, __u64 seen)
+{
+    unsigned int i;
+
+    for (i = 0; i < r->spin; i++) {
+        if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) != seen) {
+            if (r->spin < SPIN_MAX)
+                r->spin <<= 1;
+            return;
+        }
+        cpu_relax();
+    }
+    if (r->spin > SPIN_MIN)
+        r->spin >>= 1;
+
+    for (;;) {
+        __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) != seen)
+            break;
+        if (ioctl(r->fd, cmd, &seen) < 0 && errno != EINTR)
+            die("ring wait");
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
+/* Publish a counter and wake the peer if it went to sleep */
+static void ring_publish(struct ring *r, __u64 *counter, uint64_t val,
+                         __u32 *waiting, unsigned long wake)
+{
+    __atomic_store_n(counter, val, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED))
+        ioctl(r->fd, wake);
+}
+
+/* Records are a 32-bit length and the payload, padded to 8 bytes */
+static void ring_send(struct ring *r, const void *msg, uint32_t len)
+{
+    struct ring_ctrl *c = r->ctrl;
+    uint64_t need = (4 + len + 7) & ~7ULL;
+    uint64_t head = c->head, tail, room;
+
+    for (;;) {
+        room = c->size - (head & r->mask);
+        tail = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+        if (need > room) {
+            /* does not fit before the end, pad to the start */
+            if (c->size - (head - tail) < room) {
+                ring_wait(r, &c->tail, &c->producer_waiting,
+                          RING_IOC_WAIT_SPACE, tail);
+                continue;
+            }
+            *(uint32_t *)(r->data + (head & r->mask)) = PAD_RECORD;
+            head += room;
+            continue;
+        }
+        if (c->size - (head - tail) >= need)
+            break;
+        ring_wait(r, &c->tail, &c->producer_waiting, RING_IOC_WAIT_SPACE, tail);
+    }
+
+    *(uint32_t *)(r->data + (head & r->mask)) = len;
+    memcpy(r->data + (head & r->mask) + 4, msg, len);
+    ring_publish(r, &c->head, head + need, &c->consumer_waiting,
+                 RING_IOC_WAKE_CONSUMER);
+}
+
+static uint32_t ring_recv(struct ring *r, void *msg)
+{
+    struct ring_ctrl *c = r->ctrl;
+    uint64_t tail = c->tail;
+    uint32_t len;
+
+    for (;;) {
+        if (__atomic_load_n(&c->head, __ATOMIC_ACQUIRE) == tail) {
+            ring_wait(r, &c->head, &c->consumer_waiting,
+                      RING_IOC_WAIT_DATA, tail);
+            continue;
+        }
+        len = *(uint32_t *)(r->data + (tail & r->mask));
+        if (len != PAD_RECORD)
+            break;
+        tail += c->size - (tail & r->mask);
+    }
+
+    memcpy(msg, r->data + (tail & r->mask) + 4, len);
+    ring_publish(r, &c->tail, tail + ((4 + len + 7) & ~7ULL),
+                 &c->producer_waiting, RING_IOC_WAKE_PRODUCER);
+    return len;
+}
+
+static void pipe_send(int fd, const void *msg, size_t len)
+{
+    if (write(fd, msg, len) != (ssize_t)len)
+        die("pipe write");
+}
+
+static void pipe_recv(int fd, void *msg, size_t len)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    while (got < len) {
+        n = read(fd, (char *)msg + got, len - got);
+        if (n <= 0)
+            die("pipe read");
+        got += n;
+    }
+}
+
+/**
+ * Run one test, the child plays the producer (or the echoing side of a
+ * round trip) and the parent measures. ping/pong are rings when use_ring
+ * is set and pipe fds otherwise.
+ */
+static double run(int use_ring, int round_trip, long count, uint32_t size,
+                  struct ring *ping, struct ring *pong, int cpu_a, int cpu_b)
+{
+    int p1[2], p2[2];
+    char *buf = calloc(1, size);
+    double t;
+    pid_t pid;
+    long i;
+
+    if (buf == NULL)
+        die("calloc");
+    if (use_ring) {
+        ring_reset(ping);
+        ring_reset(pong);
+    } else if (pipe(p1) < 0 || pipe(p2) < 0) {
+        die("pipe");
+    }
+
+    pid = fork();
+    if (pid < 0)
+        die("fork");
+    if (pid == 0) {
+        pin(cpu_b);
+        for (i = 0; i < count; i++) {
+            if (round_trip) {
+                if (use_ring) {
+                    ring_recv(ping, buf);
+                    ring_send(pong, buf, size);
+                } else {
+                    pipe_recv(p1[0], buf, size);
+                    pipe_send(p2[1], buf, size);
+                }
+            } else if (use_ring) {
+                ring_send(ping, buf, size);
+            } else {
+                pipe_send(p1[1], buf, size);
+            }
+        }
+        _exit(0);
+    }
+
+    pin(cpu_a);
+    t = now();
+    for (i = 0; i < count; i++) {
+        if (round_trip) {
+            if (use_ring) {
+                ring_send(ping, buf, size);
+                ring_recv(pong, buf);
+            } else {
+                pipe_send(p1[1], buf, size);
+                pipe_recv(p2[0], buf, size);
+            }
+        } else if (use_ring) {
+            ring_recv(ping, buf);
+        } else {
+            pipe_recv(p1[0], buf, size);
+        }
+    }
+    t = now() - t;
+
+    waitpid(pid, NULL, 0);
+    if (!use_ring) {
+        close(p1[0]);
+        close(p1[1]);
+        close(p2[0]);
+        close(p2[1]);
+    }
+    free(buf);
+    return t;
+}
+
+int main(int argc, char **argv)
+{
+    static const uint32_t sizes[] = { 64, 1024, 16384 };
+    long count = argc > 1 ? atol(argv[1]) : 1000000;
+    int cpu_a = argc > 2 ? atoi(argv[2]) : -1;
+    int cpu_b = argc > 3 ? atoi(argv[3]) : -1;
+    struct ring ping, pong;
+    unsigned int i;
+
+    ring_open(&ping, "/dev/spsc0");
+    ring_open(&pong, "/dev/spsc1");
+
+    printf("%8s %14s %14s %12s %12s\n", "size", "ring_msg/s", "pipe_msg/s",
+           "ring_rtt_ns", "pipe_rtt_ns");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint32_t size = sizes[i];
+        long rtts = count / 10;
+        double ring_tp, pipe_tp, ring_rtt, pipe_rtt;
+
+        ring_tp = count / run(1, 0, count, size, &ping, &pong, cpu_a, cpu_b);
+        pipe_tp = count / run(0, 0, count, size, &ping, &pong, cpu_a, cpu_b);
+        ring_rtt = run(1, 1, rtts, size, &ping, &pong, cpu_a, cpu_b) / rtts;
+        pipe_rtt = run(0, 1, rtts, size, &ping, &pong, cpu_a, cpu_b) / rtts;
+
+        printf("%8u %14.0f %14.0f %12.0f %12.0f\n", size, ring_tp, pipe_tp,
+               ring_rtt * 1e9, pipe_rtt * 1e9);
+    }
+    return 0;
+}
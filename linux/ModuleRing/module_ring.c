@@ -0,0 +1,220 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/cdev.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/log2.h>
+
+#include "ring_ioctl.h"
+
+/**
+ * Number of rings, /dev/spsc0 .. /dev/spsc<nr_rings - 1>
+ */
+static unsigned int nr_rings = 2;
+module_param(nr_rings, uint, S_IRUGO);
+MODULE_PARM_DESC(nr_rings, "Number of /dev/spscN rings");
+
+/**
+ * Data region size of every ring, a power of two
+ */
+static unsigned long ring_size = 1 << 20;
+module_param(ring_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(ring_size, "Ring data size in bytes, power of two");
+
+/**
+ * One ring: the control page and the data region in one vmalloc area
+ * which is mapped into both peers.
+ */
+struct spsc_ring {
+    struct cdev cdev;
+    void *mem;
+    struct ring_ctrl *ctrl;
+    size_t mem_size;
+    wait_queue_head_t data_wq;      /* consumer sleeps here */
+    wait_queue_head_t space_wq;     /* producer sleeps here */
+};
+
+static dev_t device_num;
+static struct class *cl;
+static struct spsc_ring *rings;
+
+static int open_ring(struct inode *i, struct file *f)
+{
+    f->private_data = container_of(i->i_cdev, struct spsc_ring, cdev);
+    return 0;
+}
+
+static int close_ring(struct inode *i, struct file *f)
+{
+    return 0;
+}
+
+static int mmap_ring(struct file *f, struct vm_area_struct *vma)
+{
+    struct spsc_ring *r = f->private_data;
+
+    if (!(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+    return remap_vmalloc_range(vma, r->mem, vma->vm_pgoff);
+}
+
+/**
+ * Sleep until the peer moved the given counter away from the value the
+ * caller last saw. The condition is re-evaluated on every wakeup, so a
+ * wake that raced with the caller's last check is never lost.
+ */
+static long wait_counter(wait_queue_head_t *wq, const __u64 *counter,
+                         unsigned long arg)
+{
+    __u64 seen;
+
+    if (get_user(seen, (__u64 __user *)arg))
+        return -EFAULT;
+    return wait_event_interruptible(*wq, READ_ONCE(*counter) != seen);
+}
+
+static long ioctl_ring(struct file *f, unsigned int cmd, unsigned long arg)
+{
+    struct spsc_ring *r = f->private_data;
+
+    switch (cmd) {
+    case RING_IOC_WAIT_DATA:
+        return wait_counter(&r->data_wq, &r->ctrl->head, arg);
+    case RING_IOC_WAIT_SPACE:
+        return wait_counter(&r->space_wq, &r->ctrl->tail, arg);
+    case RING_IOC_WAKE_CONSUMER:
+        wake_up_interruptible(&r->data_wq);
+        return 0;
+    case RING_IOC_WAKE_PRODUCER:
+        wake_up_interruptible(&r->space_wq);
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+static struct file_operations ring_fops =
+{
+    .owner          = THIS_MODULE,
+    .open           = open_ring,
+    .mmap           = mmap_ring,
+    .unlocked_ioctl = ioctl_ring,
+    .compat_ioctl   = compat_ptr_ioctl,
+    .release        = close_ring
+};
+
+/**
+ * Tear down the first n rings
+ */
+static void destroy_rings(unsigned int n)
+{
+    while (n-- > 0) {
+        device_destroy(cl, MKDEV(MAJOR(device_num), n));
+        cdev_del(&rings[n].cdev);
+        vfree(rings[n].mem);
+    }
+}
+
+static int create_ring(unsigned int n)
+{
+    struct spsc_ring *r = &rings[n];
+    dev_t num = MKDEV(MAJOR(device_num), n);
+    struct device *d;
+
+    r->mem_size = PAGE_SIZE + ring_size;
+    r->mem = vmalloc_user(r->mem_size);
+    if (r->mem == NULL)
+        return -ENOMEM;
+
+    r->ctrl = r->mem;
+    r->ctrl->size = ring_size;
+    r->ctrl->data_offset = PAGE_SIZE;
+    init_waitqueue_head(&r->data_wq);
+    init_waitqueue_head(&r->space_wq);
+
+    cdev_init(&r->cdev, &ring_fops);
+    if (cdev_add(&r->cdev, num, 1) < 0) {
+        vfree(r->mem);
+        return -1;
+    }
+
+    d = device_create(cl, NULL, num, NULL, "spsc%u", n);
+    if (IS_ERR_OR_NULL(d)) {
+        cdev_del(&r->cdev);
+        vfree(r->mem);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Initialize kernel module
+ */
+static int __init ring_init(void)
+{
+    unsigned int n;
+
+    BUILD_BUG_ON(sizeof(struct ring_ctrl) > PAGE_SIZE);
+
+    if (nr_rings == 0 || nr_rings > MINORMASK)
+        return -EINVAL;
+    if (ring_size < PAGE_SIZE || !is_power_of_2(ring_size))
+        return -EINVAL;
+
+    rings = kcalloc(nr_rings, sizeof(*rings), GFP_KERNEL);
+    if (rings == NULL)
+        return -ENOMEM;
+
+    if (alloc_chrdev_region(&device_num, 0, nr_rings, "spsc") < 0) {
+        kfree(rings);
+        return -1;
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    cl = class_create("spsc");
+#else
+    cl = class_create(THIS_MODULE, "spsc");
+#endif
+    if (IS_ERR_OR_NULL(cl)) {
+        unregister_chrdev_region(device_num, nr_rings);
+        kfree(rings);
+        return -1;
+    }
+
+    for (n = 0; n < nr_rings; n++) {
+        if (create_ring(n) < 0) {
+            destroy_rings(n);
+            class_destroy(cl);
+            unregister_chrdev_region(device_num, nr_rings);
+            kfree(rings);
+            return -1;
+        }
+    }
+
+    printk(KERN_INFO "spsc: %u rings of %lu bytes\n", nr_rings, ring_size);
+    return 0;
+}
+
+/**
+ * Cleanup kernel module
+ */
+static void __exit ring_exit(void)
+{
+    destroy_rings(nr_rings);
+    class_destroy(cl);
+    unregister_chrdev_region(device_num, nr_rings);
+    kfree(rings);
+}
+
+module_init(ring_init);
+module_exit(ring_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Shared-memory SPSC ring");
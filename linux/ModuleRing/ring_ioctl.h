@@ -0,0 +1,48 @@
+#ifndef _RING_IOCTL_H
+#define _RING_IOCTL_H
+
+/**
+ * Shared-memory single-producer/single-consumer ring, /dev/spscN
+ *
+ * mmap(MAP_SHARED) of the device maps one control page followed by a
+ * power of two data region at ctrl->data_offset. The producer owns
+ * head, the consumer owns tail, both are free running byte counters
+ * and head - tail is the amount of data in the ring. Messages are
+ * moved with plain loads and stores, the kernel is only entered to
+ * sleep and to wake the peer:
+ *
+ *   consumer: set consumer_waiting, full barrier, re-check head,
+ *             RING_IOC_WAIT_DATA(tail) if still empty
+ *   producer: publish head, full barrier,
+ *             RING_IOC_WAKE_CONSUMER if consumer_waiting
+ *
+ * and the same with tail, producer_waiting and RING_IOC_WAIT_SPACE /
+ * RING_IOC_WAKE_PRODUCER when the ring is full.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define RING_CACHELINE      64
+
+struct ring_ctrl {
+    __u64 head;                 /* written by the producer */
+    __u32 consumer_waiting;
+    __u32 pad0;
+    __u8  pad1[RING_CACHELINE - 16];
+
+    __u64 tail;                 /* written by the consumer */
+    __u32 producer_waiting;
+    __u32 pad2;
+    __u8  pad3[RING_CACHELINE - 16];
+
+    __u64 size;                 /* data region size, read only */
+    __u64 data_offset;          /* data region offset in the mapping */
+};
+
+#define RING_IOC_WAIT_DATA      _IOW('S', 1, __u64)  /* until head != arg */
+#define RING_IOC_WAIT_SPACE     _IOW('S', 2, __u64)  /* until tail != arg */
+#define RING_IOC_WAKE_CONSUMER  _IO('S', 3)
+#define RING_IOC_WAKE_PRODUCER  _IO('S', 4)
+
+#endif /* _RING_IOCTL_H */
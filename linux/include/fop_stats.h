@@ -0,0 +1,195 @@
+#ifndef _FOP_STATS_H
+#define _FOP_STATS_H
+
+/**
+ * Per-CPU file operation statistics shared by the Linux modules.
+ *
+ * Every operation keeps a call and byte counter and a log2 latency
+ * histogram in per-CPU memory, so the hot path is a few this_cpu_*()
+ * increments and no locks.  The per-CPU copies are merged only when
+ * the debugfs "stats" file is read, writing to "reset" clears them.
+ *
+ *   u64 t = fop_stats_start();
+ *   ...
+ *   fop_stats_end(&stats, OP_READ, len, t);
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/sched/clock.h>
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+
+#define FOP_STATS_BUCKETS 64
+
+/**
+ * Counters of one operation on one CPU, bucket i counts calls
+ * which took [2^(i-1), 2^i) nanoseconds.
+ */
+struct fop_stats_op {
+    u64 ops;
+    u64 bytes;
+    u64 ns;
+    u64 hist[FOP_STATS_BUCKETS];
+};
+
+struct fop_stats {
+    const char * const *names;
+    unsigned int nr_ops;
+    struct fop_stats_op __percpu *pcpu;
+};
+
+static inline int fop_stats_init(struct fop_stats *s,
+                                 const char * const *names,
+                                 unsigned int nr_ops)
+{
+    s->names = names;
+    s->nr_ops = nr_ops;
+    s->pcpu = __alloc_percpu(nr_ops * sizeof(struct fop_stats_op),
+                             SMP_CACHE_BYTES);
+    return s->pcpu ? 0 : -ENOMEM;
+}
+
+static inline void fop_stats_destroy(struct fop_stats *s)
+{
+    free_percpu(s->pcpu);
+    s->pcpu = NULL;
+}
+
+static inline u64 fop_stats_start(void)
+{
+    return local_clock();
+}
+
+static inline void fop_stats_end(struct fop_stats *s, unsigned int op,
+                                 size_t bytes, u64 start)
+{
+    u64 delta = local_clock() - start;
+    unsigned int b = min_t(unsigned int, fls64(delta), FOP_STATS_BUCKETS - 1);
+
+    this_cpu_inc(s->pcpu[op].ops);
+    this_cpu_add(s->pcpu[op].bytes, bytes);
+    this_cpu_add(s->pcpu[op].ns, delta);
+    this_cpu_inc(s->pcpu[op].hist[b]);
+}
+
+static inline void fop_stats_reset(struct fop_stats *s)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(s->pcpu, cpu), 0,
+               s->nr_ops * sizeof(struct fop_stats_op));
+}
+
+/**
+ * Upper bound in nanoseconds of the bucket holding the q-th
+ * per-mille call, e.g. q = 999 for p999.
+ */
+static inline u64 fop_stats_quantile(const struct fop_stats_op *m,
+                                     unsigned int q)
+{
+    u64 target, seen = 0;
+    unsigned int b;
+
+    if (m->ops == 0)
+        return 0;
+
+    target = div_u64(m->ops * q + 999, 1000);
+    for (b = 0; b < FOP_STATS_BUCKETS; b++) {
+        seen += m->hist[b];
+        if (seen >= target)
+            break;
+    }
+    return b == 0 ? 0 : 1ULL << min_t(unsigned int, b, 63);
+}
+
+static inline int fop_stats_show(struct seq_file *sf, void *unused)
+{
+    struct fop_stats *s = sf->private;
+    struct fop_stats_op m;
+    unsigned int op, b;
+    int cpu;
+
+    seq_printf(sf, "%-8s %12s %16s %10s %10s %10s %10s\n",
+               "op", "ops", "bytes", "avg_ns", "p50_ns", "p99_ns", "p999_ns");
+
+    for (op = 0; op < s->nr_ops; op++) {
+        memset(&m, 0, sizeof(m));
+        for_each_possible_cpu(cpu) {
+            const struct fop_stats_op *c = per_cpu_ptr(&s->pcpu[op], cpu);
+
+            m.ops += c->ops;
+            m.bytes += c->bytes;
+            m.ns += c->ns;
+            for (b = 0; b < FOP_STATS_BUCKETS; b++)
+                m.hist[b] += c->hist[b];
+        }
+
+        seq_printf(sf, "%-8s %12llu %16llu %10llu %10llu %10llu %10llu\n",
+                   s->names[op], m.ops, m.bytes,
+                   m.ops ? div64_u64(m.ns, m.ops) : 0,
+                   fop_stats_quantile(&m, 500),
+                   fop_stats_quantile(&m, 990),
+                   fop_stats_quantile(&m, 999));
+    }
+
+    seq_puts(sf, "\ncpu      op                ops     avg_ns\n");
+    for_each_online_cpu(cpu) {
+        for (op = 0; op < s->nr_ops; op++) {
+            const struct fop_stats_op *c = per_cpu_ptr(&s->pcpu[op], cpu);
+
+            if (c->ops == 0)
+                continue;
+            seq_printf(sf, "%-8d %-8s %12llu %10llu\n", cpu, s->names[op],
+                       c->ops, div64_u64(c->ns, c->ops));
+        }
+    }
+
+    return 0;
+}
+
+static inline int fop_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, fop_stats_show, inode->i_private);
+}
+
+static inline ssize_t fop_stats_reset_write(struct file *file,
+                                            const char __user *buf,
+                                            size_t len, loff_t *off)
+{
+    struct fop_stats *s = file_inode(file)->i_private;
+
+    fop_stats_reset(s);
+    return len;
+}
+
+static const struct file_operations fop_stats_fops = {
+    .owner   = THIS_MODULE,
+    .open    = fop_stats_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations fop_stats_reset_fops = {
+    .owner   = THIS_MODULE,
+    .open    = simple_open,
+    .write   = fop_stats_reset_write,
+    .llseek  = noop_llseek,
+};
+
+/**
+ * Create "stats" and "reset" in the given debugfs directory.
+ */
+static inline void fop_stats_debugfs(struct fop_stats *s, struct dentry *dir)
+{
+    debugfs_create_file("stats", 0400, dir, s, &fop_stats_fops);
+    debugfs_create_file("reset", 0200, dir, s, &fop_stats_reset_fops);
+}
+
+#endif /* _FOP_STATS_H */